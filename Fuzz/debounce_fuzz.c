@@ -0,0 +1,532 @@
+/*
+ * Differential fuzz harness for the debouncer.
+ *
+ * Every engine (storage layout, and any specialised or optimised update path
+ * reachable through the public API) is driven with the same thresholds and
+ * input stream as a reference copy of the original scalar integrator. After
+ * every tick the harness checks that each engine's counters, state and edge
+ * flags, event order, state bitmap and dirty list match the reference, and
+ * aborts on the first difference. Engines that detect shared pins must also
+ * read every pin at most once per update, including across groups and
+ * across the per-button kernel calls of a deadline budget. Budgeted engines
+ * run DB_Update_Budget until it completes a pass on every tick, and are
+ * checked after each completed pass.
+ *
+ * libFuzzer:
+ * clang -g -O1 -fsanitize=fuzzer,address,undefined -IInc Fuzz/debounce_fuzz.c Src/debounce.c -o debounce_fuzz
+ * ./debounce_fuzz
+ *
+ * Standalone (replays the files given as arguments, or runs seeded random
+ * inputs if none are given):
+ * cc -g -O1 -DDB_FUZZ_STANDALONE -IInc Fuzz/debounce_fuzz.c Src/debounce.c -o debounce_fuzz
+ * ./debounce_fuzz [input...]
+ *
+ * The harness drives callbacks and edge latches, so it is built without the
+ * DB_CONFIG_NO_* feature stripping options.
+ *
+ * Input format:
+ * byte 0: button count - 1 (bits 0-4), small thresholds (bit 5), pairs of
+ *   buttons sharing a pin (bit 6), every button using the first threshold
+ *   (bit 7, which selects the uniform threshold kernels)
+ * next count bytes: thresholds, reduced to 1-31 when small thresholds are
+ *   selected so the packed layout takes part, and scaled past 255 when
+ *   built with DB_CONFIG_WIDE_COUNTERS
+ * then per tick: 4 bytes of pin levels (bit i = pin i), 1 poll byte
+ *   (bits 0-4 select a button, bits 5-6 select none, DB_Rising, DB_Falling or
+ *   DB_Changed, applied identically to every engine)
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <debounce.h>
+
+#define FUZZ_MAX_BUTTONS 32
+#define FUZZ_MAX_EVENTS (2 * FUZZ_MAX_BUTTONS)
+
+/*
+ * Reference integrator, kept identical to the original scalar DB_Update.
+ */
+typedef struct {
+	uint16_t threshold;
+	uint16_t counter;
+	uint8_t state;
+} Ref_Button;
+
+enum {
+	ref_curr_state = 0x01,
+	ref_falling_edge = 0x02,
+	ref_rising_edge = 0x04
+};
+
+typedef struct {
+	uint8_t idx;
+	DB_Event_Type ev_type;
+} Fuzz_Event;
+
+typedef struct {
+	Fuzz_Event ev[FUZZ_MAX_EVENTS];
+	int count;
+} Fuzz_Log;
+
+static uint32_t pins;
+static uint8_t pin_of[FUZZ_MAX_BUTTONS];
+static uint8_t reads[32];
+
+static bool fuzz_read(uint8_t pin) {
+	reads[pin]++;
+	return (pins >> pin) & 1;
+}
+
+static bool fuzz_never(void) {
+	return false;
+}
+
+static DB_Word fuzz_port(void *ctx, uint8_t group) {
+	(void)ctx;
+	(void)group;
+	return pins;
+}
+
+static void ref_init(Ref_Button *ref, int count) {
+	for (int i = 0; i < count; i++) {
+		bool in = fuzz_read(pin_of[i]);
+		ref[i].state = in;
+		ref[i].counter = in * ref[i].threshold;
+	}
+}
+
+static void ref_update(Ref_Button *ref, int count, Fuzz_Log *log) {
+	for (int i = 0; i < count; i++) {
+		Ref_Button *btn = &ref[i];
+		if (fuzz_read(pin_of[i])) {
+			if (btn->counter < btn->threshold) {
+				btn->counter++;
+			}
+			else {
+				if ((btn->state & ref_curr_state) == 0) {
+					btn->state = btn->state | ref_rising_edge;
+					log->ev[log->count++] = (Fuzz_Event){.idx = i, .ev_type = DB_RISING_EDGE};
+				}
+				btn->state = btn->state | ref_curr_state;
+			}
+		}
+		else {
+			if (btn->counter != 0) {
+				btn->counter--;
+			}
+			else {
+				if ((btn->state & ref_curr_state) == 1) {
+					btn->state = btn->state | ref_falling_edge;
+					log->ev[log->count++] = (Fuzz_Event){.idx = i, .ev_type = DB_FALLING_EDGE};
+				}
+				btn->state = btn->state & ~ref_curr_state;
+			}
+		}
+	}
+}
+
+static bool ref_take(Ref_Button *btn, uint8_t mask) {
+	if ((btn->state & mask) != 0) {
+		btn->state = btn->state & ~mask;
+		return true;
+	}
+	return false;
+}
+
+/*
+ * Engines under test.
+ */
+typedef struct {
+	const char *name;
+	uint16_t max_threshold;
+	bool callbacks;
+	bool reads_once;
+	bool bare; // no state bitmap or dirty list, so nothing but flags sees edges
+	uint8_t oversample; // read through a group port when not 0
+	bool grouped; // split into two groups with a shared pin pair across them
+	bool budgeted; // update with DB_Update_Budget(db, budget, expired) passes
+	uint8_t budget;
+	DB_Deadline expired;
+	bool active;
+	DB_Handle db;
+	DB_Button *btns; // FUZZ_MAX_BUTTONS, allocated by engine_init
+	DB_Config cfg[FUZZ_MAX_BUTTONS];
+	DB_Packed packed[FUZZ_MAX_BUTTONS];
+	DB_State states[FUZZ_MAX_BUTTONS];
+	DB_Button *slots[FUZZ_MAX_BUTTONS];
+	uint8_t free_slots[FUZZ_MAX_BUTTONS];
+	DB_Word state_bits[DB_WORDS(FUZZ_MAX_BUTTONS)];
+	uint8_t dirty[FUZZ_MAX_BUTTONS];
+	DB_Group *groups; // 2, allocated by engine_init
+	Fuzz_Log log;
+	uint8_t pass_dirty[FUZZ_MAX_BUTTONS]; // dirty lists of the calls in a pass
+	int pass_dirty_count;
+} Fuzz_Engine;
+
+enum {
+	ENGINE_BUTTON,
+	ENGINE_PACKED,
+	ENGINE_SPLIT,
+	ENGINE_POOL,
+	ENGINE_BUTTON_POLLING,
+	ENGINE_BUTTON_BARE,
+	ENGINE_PORT,
+	ENGINE_PORT_BARE,
+	ENGINE_BUDGET_FULL,
+	ENGINE_BUDGET_SMALL,
+	ENGINE_GROUPS,
+	ENGINE_BUDGET_DEADLINE,
+	ENGINE_COUNT
+};
+
+static Fuzz_Engine engines[ENGINE_COUNT] = {
+	[ENGINE_BUTTON] = {.name = "button", .max_threshold = DB_MAX_THRESHOLD, .callbacks = true, .reads_once = true},
+	[ENGINE_PACKED] = {.name = "packed", .max_threshold = DB_PACKED_MAX_THRESHOLD, .callbacks = true, .reads_once = true},
+	[ENGINE_SPLIT] = {.name = "split", .max_threshold = DB_MAX_THRESHOLD, .callbacks = true, .reads_once = true},
+	// pool handles do not detect shared pins
+	[ENGINE_POOL] = {.name = "pool", .max_threshold = DB_MAX_THRESHOLD, .callbacks = true, .reads_once = false},
+	[ENGINE_BUTTON_POLLING] = {.name = "button polling", .max_threshold = DB_MAX_THRESHOLD, .callbacks = false, .reads_once = true},
+	// polling-only kernels, per pin and from a port word
+	[ENGINE_BUTTON_BARE] = {.name = "button bare", .max_threshold = DB_MAX_THRESHOLD, .callbacks = false, .reads_once = true, .bare = true},
+	[ENGINE_PORT] = {.name = "port", .max_threshold = DB_MAX_THRESHOLD, .callbacks = true, .reads_once = true, .oversample = 3},
+	[ENGINE_PORT_BARE] = {.name = "port bare", .max_threshold = DB_MAX_THRESHOLD, .callbacks = false, .reads_once = true, .bare = true, .oversample = 5},
+	// one call per pass, and several calls of 3 buttons per pass
+	[ENGINE_BUDGET_FULL] = {.name = "budget full", .max_threshold = DB_MAX_THRESHOLD, .callbacks = true, .reads_once = true, .budgeted = true, .budget = 0},
+	[ENGINE_BUDGET_SMALL] = {.name = "budget small", .max_threshold = DB_MAX_THRESHOLD, .callbacks = true, .reads_once = true, .budgeted = true, .budget = 3},
+	// read once per update, not per kernel call
+	[ENGINE_GROUPS] = {.name = "groups", .max_threshold = DB_MAX_THRESHOLD, .callbacks = true, .reads_once = true, .grouped = true},
+	[ENGINE_BUDGET_DEADLINE] = {.name = "budget deadline", .max_threshold = DB_MAX_THRESHOLD, .callbacks = true, .reads_once = true, .budgeted = true, .budget = 0, .expired = fuzz_never}
+};
+
+static Fuzz_Engine *current;
+
+static void fuzz_callback(DB_Event ev) {
+	if (ev.enc != NULL || current->log.count == FUZZ_MAX_EVENTS) {
+		abort();
+	}
+	current->log.ev[current->log.count++] = (Fuzz_Event){.idx = ev.idx, .ev_type = ev.ev_type};
+}
+
+/*
+ * Buttons and groups have const members, which must not be written through
+ * casts. They are built as values and copied into allocated storage, which
+ * has no declared type.
+ */
+static void *fuzz_alloc(void *old, size_t size) {
+	free(old);
+	void *p = malloc(size);
+	if (p == NULL) {
+		abort();
+	}
+	return p;
+}
+
+static void engine_init(Fuzz_Engine *e, int id, const uint16_t *thresholds, int count) {
+	DB_Event_Callback cb = e->callbacks ? fuzz_callback : NULL;
+	e->btns = fuzz_alloc(e->btns, FUZZ_MAX_BUTTONS * sizeof(DB_Button));
+	e->groups = fuzz_alloc(e->groups, 2 * sizeof(DB_Group));
+	for (int i = 0; i < count; i++) {
+		uint16_t th = thresholds[i];
+		DB_Button btn = {.pin = pin_of[i], .threshold = th};
+		memcpy(&e->btns[i], &btn, sizeof(btn));
+		e->cfg[i].pin = pin_of[i];
+		e->cfg[i].threshold = th;
+	}
+	switch (id) {
+	case ENGINE_PACKED:
+		DB_Init_Packed(&e->db, e->cfg, e->packed, count, fuzz_read, cb);
+		break;
+	case ENGINE_SPLIT:
+		DB_Init_Split(&e->db, e->cfg, e->states, count, fuzz_read, cb);
+		break;
+	case ENGINE_POOL:
+		DB_Init_Pool(&e->db, e->slots, e->free_slots, count, fuzz_read, cb);
+		for (int i = 0; i < count; i++) {
+			if (DB_Attach(&e->db, &e->btns[i]) != i) {
+				abort();
+			}
+		}
+		break;
+	default:
+		DB_Init(&e->db, e->btns, count, fuzz_read, cb);
+		break;
+	}
+	if (e->oversample != 0) {
+		DB_Group group = {.first = 0, .count = count, .port = fuzz_port, .oversample = e->oversample};
+		memcpy(&e->groups[0], &group, sizeof(group));
+		DB_Init_Groups(&e->db, e->groups, 1);
+	}
+	if (e->grouped) {
+		// an odd split puts the buttons of one shared pin pair in different groups
+		int split = (count / 2) | 1;
+		DB_Group low = {.first = 0, .count = split};
+		DB_Group high = {.first = split, .count = count - split};
+		memcpy(&e->groups[0], &low, sizeof(low));
+		memcpy(&e->groups[1], &high, sizeof(high));
+		DB_Init_Groups(&e->db, e->groups, 2);
+	}
+	if (!e->bare) {
+		DB_Init_Bitmap(&e->db, e->state_bits);
+		DB_Init_Dirty(&e->db, e->dirty);
+	}
+}
+
+static void engine_get(const Fuzz_Engine *e, int id, int i, unsigned *counter, unsigned *state) {
+	switch (id) {
+	case ENGINE_PACKED:
+		*counter = e->packed[i] >> 3;
+		*state = e->packed[i] & 0x07;
+		break;
+	case ENGINE_SPLIT:
+		*counter = e->states[i]._counter;
+		*state = e->states[i]._state;
+		break;
+	default:
+		*counter = e->btns[i]._counter;
+		*state = e->btns[i]._state;
+		break;
+	}
+}
+
+static void fail(const Fuzz_Engine *e, int tick, const char *what, int idx) {
+	fprintf(stderr, "debounce_fuzz: %s engine diverged at tick %d: %s (button %d)\n", e->name, tick, what, idx);
+	abort();
+}
+
+static void check(const Fuzz_Engine *e, int id, const Ref_Button *ref, int count, const Fuzz_Log *ref_log, int tick) {
+	for (int i = 0; i < count; i++) {
+		unsigned counter, state;
+		engine_get(e, id, i, &counter, &state);
+		if (counter != ref[i].counter) {
+			fail(e, tick, "counter", i);
+		}
+		if (state != ref[i].state) {
+			fail(e, tick, "state flags", i);
+		}
+		if (DB_Rd_Idx(&e->db, i) != (ref[i].state & ref_curr_state)) {
+			fail(e, tick, "DB_Rd_Idx", i);
+		}
+		if (!e->bare && ((DB_Rd_Bitmap(&e->db)[i / DB_WORD_BITS] >> (i % DB_WORD_BITS)) & 1) != (ref[i].state & ref_curr_state)) {
+			fail(e, tick, "state bitmap", i);
+		}
+	}
+
+	if (e->bare) {
+		return;
+	}
+	if (e->pass_dirty_count != ref_log->count) {
+		fail(e, tick, "dirty list length", -1);
+	}
+	for (int k = 0; k < e->pass_dirty_count; k++) {
+		if (e->pass_dirty[k] != ref_log->ev[k].idx) {
+			fail(e, tick, "dirty list order", e->pass_dirty[k]);
+		}
+	}
+
+	if (!e->callbacks) {
+		return;
+	}
+	if (e->log.count != ref_log->count) {
+		fail(e, tick, "event count", -1);
+	}
+	for (int k = 0; k < ref_log->count; k++) {
+		if (e->log.ev[k].idx != ref_log->ev[k].idx || e->log.ev[k].ev_type != ref_log->ev[k].ev_type) {
+			fail(e, tick, "event order", ref_log->ev[k].idx);
+		}
+	}
+}
+
+/*
+ * Run one full pass of an engine, checking how often each pin is read by
+ * every call and collecting the dirty lists of the calls.
+ */
+static void engine_update(Fuzz_Engine *e, int count, int tick) {
+	e->log.count = 0;
+	e->pass_dirty_count = 0;
+	bool done = false;
+	while (!done) {
+		for (int p = 0; p < 32; p++) {
+			reads[p] = 0;
+		}
+		if (e->budgeted) {
+			done = DB_Update_Budget(&e->db, e->budget, e->expired);
+		}
+		else {
+			DB_Update(&e->db);
+			done = true;
+		}
+		for (int i = 0; i < count; i++) {
+			if (e->reads_once && reads[pin_of[i]] > 1) {
+				fail(e, tick, "pin read more than once", i);
+			}
+		}
+		if (!e->bare) {
+			const uint8_t *dirty;
+			int dirty_count = DB_Dirty(&e->db, &dirty);
+			if (e->pass_dirty_count + dirty_count > FUZZ_MAX_BUTTONS) {
+				fail(e, tick, "dirty list length", -1);
+			}
+			memcpy(&e->pass_dirty[e->pass_dirty_count], dirty, dirty_count);
+			e->pass_dirty_count += dirty_count;
+		}
+	}
+}
+
+static bool poll(DB_Handle *db, uint8_t op, uint8_t idx) {
+	switch (op) {
+	case 1:
+		return DB_Rising_Idx(db, idx);
+	case 2:
+		return DB_Falling_Idx(db, idx);
+	default:
+		return DB_Changed_Idx(db, idx);
+	}
+}
+
+static bool ref_poll(Ref_Button *btn, uint8_t op) {
+	switch (op) {
+	case 1:
+		return ref_take(btn, ref_rising_edge);
+	case 2:
+		return ref_take(btn, ref_falling_edge);
+	default:
+		return ref_take(btn, ref_rising_edge | ref_falling_edge);
+	}
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	if (size < 1) {
+		return 0;
+	}
+	int count = (data[0] & 0x1F) + 1;
+	bool small_th = (data[0] & 0x20) != 0;
+	bool shared = (data[0] & 0x40) != 0;
+	bool uniform = (data[0] & 0x80) != 0;
+	if (size < (size_t)(1 + count)) {
+		return 0;
+	}
+	const uint8_t *thresholds = &data[1];
+	data += 1 + count;
+	size -= 1 + count;
+
+	Ref_Button ref[FUZZ_MAX_BUTTONS];
+	uint16_t th[FUZZ_MAX_BUTTONS];
+	uint16_t max_th = 0;
+	for (int i = 0; i < count; i++) {
+		th[i] = thresholds[uniform ? 0 : i];
+		if (small_th) {
+			th[i] = th[i] % DB_PACKED_MAX_THRESHOLD + 1;
+		}
+		else {
+#ifdef DB_CONFIG_WIDE_COUNTERS
+			th[i] = th[i] * 3;
+#endif
+			if (th[i] == 0) {
+				th[i] = 1;
+			}
+		}
+		ref[i].threshold = th[i];
+		max_th = (th[i] > max_th) ? th[i] : max_th;
+	}
+
+	for (int i = 0; i < count; i++) {
+		pin_of[i] = shared ? i / 2 : i;
+	}
+	pins = 0;
+	ref_init(ref, count);
+	for (int id = 0; id < ENGINE_COUNT; id++) {
+		Fuzz_Engine *e = &engines[id];
+		e->active = (max_th <= e->max_threshold);
+		if (e->active) {
+			current = e;
+			engine_init(e, id, th, count);
+		}
+	}
+
+	for (int tick = 0; size >= 5; tick++, data += 5, size -= 5) {
+		pins = (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+		uint8_t op = (data[4] >> 5) & 0x03;
+		uint8_t idx = (data[4] & 0x1F) % count;
+
+		Fuzz_Log ref_log = {.count = 0};
+		ref_update(ref, count, &ref_log);
+
+		for (int id = 0; id < ENGINE_COUNT; id++) {
+			Fuzz_Engine *e = &engines[id];
+			if (!e->active) {
+				continue;
+			}
+			current = e;
+			engine_update(e, count, tick);
+			check(e, id, ref, count, &ref_log, tick);
+		}
+
+		if (op != 0) {
+			bool ref_polled = ref_poll(&ref[idx], op);
+			for (int id = 0; id < ENGINE_COUNT; id++) {
+				if (engines[id].active && poll(&engines[id].db, op, idx) != ref_polled) {
+					fail(&engines[id], tick, "polled edge", idx);
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+#ifdef DB_FUZZ_STANDALONE
+static uint32_t xorshift(uint32_t *s) {
+	*s ^= *s << 13;
+	*s ^= *s >> 17;
+	*s ^= *s << 5;
+	return *s;
+}
+
+int main(int argc, char **argv) {
+	static uint8_t buf[1 << 16];
+	if (argc > 1) {
+		for (int a = 1; a < argc; a++) {
+			FILE *f = fopen(argv[a], "rb");
+			if (f == NULL) {
+				perror(argv[a]);
+				return 1;
+			}
+			size_t n = fread(buf, 1, sizeof(buf), f);
+			fclose(f);
+			LLVMFuzzerTestOneInput(buf, n);
+		}
+		return 0;
+	}
+
+	uint32_t seed = 0x2545F491;
+	for (int run = 0; run < 2000; run++) {
+		// frames start after the thresholds, so the count is chosen first
+		uint8_t mode = (uint8_t)xorshift(&seed);
+		int count = (mode & 0x1F) + 1;
+		size_t n = 1 + count + 5 * (xorshift(&seed) % 2000);
+		// bias pins towards holding their level so buttons actually settle
+		uint32_t level = xorshift(&seed);
+		uint32_t churn = xorshift(&seed) % 8 + 1;
+		buf[0] = mode;
+		for (size_t i = 1; i < n; i++) {
+			buf[i] = (uint8_t)xorshift(&seed);
+		}
+		for (size_t t = 1 + count; t + 5 <= n; t += 5) {
+			for (int b = 0; b < 32; b++) {
+				if (xorshift(&seed) % (churn * 4) == 0) {
+					level ^= (uint32_t)1 << b;
+				}
+			}
+			for (int k = 0; k < 4; k++) {
+				buf[t + k] = (uint8_t)(level >> (8 * k));
+			}
+		}
+		LLVMFuzzerTestOneInput(buf, n);
+	}
+	printf("debounce_fuzz: 2000 random inputs passed\n");
+	return 0;
+}
+#endif
@@ -25,6 +25,9 @@
  * the button state to be changed. Threshold also determines the minimum number of
  * DB_Update calls required between state changes.
  * This library will use pointers to these buttons to access and identify them.
+ * Several buttons may share a pin, for example a fast "touch" button and a
+ * slow "confirm" button with different thresholds. DB_Init detects this, and
+ * each shared pin is then only read once per update.
  * Note: threshold must not equal 0
  * ex:
  * DB_Button buttons[] = {
@@ -50,6 +53,20 @@
  *   negatively affect debounce quality.
  * ex:
  * DB_Update(&db);
+ *
+ * On a crowded tick, DB_Update_Budget can be called instead to update at
+ * most a fixed number of buttons per call, or to stop once a deadline
+ * function reports that the time slice is used up. Each call resumes where
+ * the previous one stopped, so with a budget of K buttons every button is
+ * sampled once every ceil(count / K) calls. Thresholds then count passes
+ * rather than calls. Encoders are updated on every call, and scan groups
+ * are ignored.
+ * ex:
+ * bool Slice_Expired(void) {
+ *   return DWT->CYCCNT - slice_start > SLICE_CYCLES;
+ * }
+ * DB_Update_Budget(&db, 16, NULL);          // 16 buttons per call
+ * DB_Update_Budget(&db, 0, Slice_Expired);  // until the deadline
  */
 
 /*
@@ -60,6 +77,77 @@
  * bool state = DB_Rd(buttons[0]);
  */
 
+/*
+ * State bitmap:
+ * A handle can maintain a packed bitmap of every button's debounced state,
+ * with button idx stored in bit (idx % 32) of word (idx / 32). The bitmap is
+ * only written when a button changes state, and can be fetched in one call
+ * for chord matching or exporting state.
+ * ex:
+ * DB_Word state_bits[DB_WORDS(count)];
+ * DB_Init_Bitmap(&db, state_bits);
+ * ...
+ * const DB_Word *bits = DB_Rd_Bitmap(&db);
+ * bool ctrl_alt = (bits[0] & 0x03) == 0x03;
+ *
+ * Edge bitmaps work the same way for rising and falling edges. DB_Update ORs
+ * every edge into them, and DB_Fetch_Edges atomically swaps each word for
+ * zero, so a consumer (even in another thread or ISR) handles every edge
+ * since its last fetch without touching the per-button edge flags.
+ * The GCC/Clang __atomic builtins are used where they are lock-free for
+ * 32-bit words. Elsewhere (other compilers, Cortex-M0/M0+) plain accesses
+ * are used, and DB_Fetch_Edges must not run while DB_Update can preempt it
+ * (or the other way round) unless interrupts are masked around it. Define
+ * DB_ATOMIC_OR, DB_ATOMIC_AND and DB_ATOMIC_XCHG when building debounce.c to
+ * use other primitives.
+ * ex:
+ * DB_Word rise_bits[DB_WORDS(count)], fall_bits[DB_WORDS(count)];
+ * DB_Init_Edge_Bitmaps(&db, rise_bits, fall_bits);
+ * ...
+ * DB_Word rising[DB_WORDS(count)];
+ * DB_Fetch_Edges(&db, rising, NULL);
+ * while (rising[0] != 0) {
+ *   int idx = __builtin_ctz(rising[0]);
+ *   rising[0] &= rising[0] - 1;
+ *   // handle press on idx
+ * }
+ */
+
+/*
+ * Sample history:
+ * A handle can keep a shift register of the last DB_HISTORY_BITS samples of
+ * every button, either debounced states or raw pin reads. Questions about a
+ * recent window, such as "was this held at any point in the last 20
+ * samples" or "how many of the last 32 samples were high", are then answered
+ * with a mask and a popcount. Histories are 32 bits wide, or 64 bits when
+ * built with DB_CONFIG_HISTORY_64. Samples skipped by prescalers or dividers
+ * are not recorded.
+ * ex:
+ * DB_History history[count];
+ * DB_Init_History(&db, history, false); // false: debounced, true: raw
+ * ...
+ * bool tapped = DB_Held_Within(&db, 3, 20);
+ * uint8_t duty = DB_Duty(&db, 3, 32); // samples high out of 32
+ */
+
+/*
+ * Dirty list:
+ * A handle can record the indices of the buttons whose debounced state
+ * changed during the last DB_Update call, so application code only visits
+ * buttons with activity. The list is cleared at the start of every DB_Update
+ * call and holds each index at most once.
+ * ex:
+ * uint8_t dirty[count];
+ * DB_Init_Dirty(&db, dirty);
+ * ...
+ * DB_Update(&db);
+ * const uint8_t *changed;
+ * uint8_t n = DB_Dirty(&db, &changed);
+ * for (int i = 0; i < n; i++) {
+ *   bool state = DB_Rd_Idx(&db, changed[i]);
+ * }
+ */
+
 /*
  * Events:
  * There are two ways to receive button events, callbacks and polling, depending
@@ -97,6 +185,291 @@
  * Pass a pointer to your event handler to DB_Init during your initial setup.
  * ex:
  * DB_Init(&db, buttons, count, Read_GPIO, Event_Handler);
+ *
+ * Per-button handlers:
+ * With many buttons, comparing ev.btn against every button gets slow. A
+ * DB_Handler table with one entry per button index routes each event
+ * directly to that button's handler, along with a user context pointer.
+ * Entries with a NULL fn fall back to the callback passed to DB_Init.
+ * ex:
+ * void Volume_Handler(DB_Event ev, void *ctx) {
+ *   int *volume = ctx;
+ *   // do something
+ * }
+ * const DB_Handler handlers[] = {
+ *   {.fn = Volume_Handler, .ctx = &volume},
+ *   {.fn = NULL}
+ * };
+ * DB_Init_Handlers(&db, handlers);
+ */
+
+/*
+ * Rotary encoders:
+ * Quadrature encoders can be debounced by the same handle as your buttons.
+ * Both the A and B channels are run through the integrator, and the debounced
+ * channels are decoded into signed steps.
+ *
+ * 1. Define a DB_Encoder array.
+ * Enter both channel pins, the threshold used for both channels, and the
+ * number of quadrature transitions per reported step (usually 4 for detented
+ * encoders, 0 is treated as 4).
+ * Note: the threshold should be kept small (1-3). Each quadrature phase must
+ *   last longer than the threshold in DB_Update calls at your fastest spin.
+ *   A phase skipped because both channels settle on the same call is
+ *   recovered using the last known direction.
+ * ex:
+ * DB_Encoder encoders[] = {
+ *   {.pin_a = 8, .pin_b = 9, .threshold = 2, .detent = 4}
+ * };
+ *
+ * 2. Attach the encoders after DB_Init.
+ * ex:
+ * DB_Init_Encoders(&db, encoders, sizeof(encoders)/sizeof(DB_Encoder));
+ *
+ * 3. Read the steps.
+ * DB_Enc_Steps returns the signed number of steps since it was last called,
+ * and DB_Enc_Position returns the running total. If an event callback is
+ * registered, every step also produces a DB_ENC_CW or DB_ENC_CCW event with
+ * the enc field set and btn left NULL.
+ * ex:
+ * int16_t steps = DB_Enc_Steps(&encoders[0]);
+ */
+
+/*
+ * Virtual buttons:
+ * Chords and interlocks can be defined as virtual buttons whose state is the
+ * AND or OR of other buttons' debounced states, each optionally inverted.
+ * A virtual button is only re-evaluated when one of its inputs changes, and
+ * changes of its state set the usual edge flags on its btn member and raise
+ * normal events with btn pointing at that member and virt set. Use DB_Rd,
+ * DB_Rising, DB_Falling and DB_Changed on &virt->btn to poll it.
+ * Note: inputs are button indices. Virtual buttons are not part of state
+ *   bitmaps, dirty lists or per-button handler tables.
+ * ex:
+ * static const uint8_t ctrl_alt_del[] = {0, 1, 2};
+ * static const uint8_t start_safe[] = {3, 4};
+ * DB_Virtual virtuals[] = {
+ *   {.inputs = ctrl_alt_del, .count = 3, .op = DB_VIRT_AND},
+ *   {.inputs = start_safe, .count = 2, .op = DB_VIRT_AND, .invert = 0x2} // start AND NOT guard open
+ * };
+ * DB_Init_Virtual(&db, virtuals, 2);
+ * ...
+ * if (DB_Rising(&virtuals[0].btn)) {
+ *   // chord pressed
+ * }
+ */
+
+/*
+ * Packed layout:
+ * Large button arrays can use a compact layout instead of DB_Button, where the
+ * pin and threshold live in a separate DB_Config table and each button's
+ * counter and flags share a single DB_Packed byte. Thresholds are limited to
+ * DB_PACKED_MAX_THRESHOLD.
+ *
+ * Buttons in a packed handle are identified by their index. Use DB_Rd_Idx,
+ * DB_Rising_Idx, DB_Falling_Idx and DB_Changed_Idx instead of the pointer
+ * based functions, and the idx field of DB_Event in callbacks.
+ * ex:
+ * const DB_Config config[] = {
+ *   {.pin = 4, .threshold = 20},
+ *   {.pin = 23, .threshold = 8}
+ * };
+ * DB_Packed state[2];
+ * DB_Init_Packed(&db, config, state, 2, Read_GPIO, NULL);
+ * bool x = DB_Rd_Idx(&db, 1);
+ */
+
+/*
+ * Split layout:
+ * When thresholds above DB_PACKED_MAX_THRESHOLD are needed, the split layout
+ * keeps the same DB_Config table but stores each button's counter and flags
+ * in a small DB_State. Only the DB_State array is written by DB_Update.
+ *
+ * In both the packed and split layouts the DB_Config table is never written,
+ * so it can be declared const and placed in flash. On targets where flash
+ * must be read through special instructions, define DB_FLASH as the section
+ * attribute and DB_FLASH_RD as the accessor before including this header.
+ * ex (AVR):
+ * #define DB_FLASH PROGMEM
+ * #define DB_FLASH_RD(x) (sizeof(x) == 1 ? pgm_read_byte(&(x)) : pgm_read_word(&(x)))
+ *
+ * ex:
+ * static const DB_Config config[] DB_FLASH = {
+ *   {.pin = 4, .threshold = 200},
+ *   {.pin = 23, .threshold = 8}
+ * };
+ * DB_State state[2];
+ * DB_Init_Split(&db, config, state, 2, Read_GPIO, NULL);
+ */
+
+/*
+ * Scan groups:
+ * By default every button is scanned on every DB_Update call. Inputs that
+ * change slowly, like DIP switches or door contacts, can be placed in a
+ * DB_Group with a scan divider so they are only read every Nth call. Each
+ * group covers a contiguous range of button indices, and thresholds of
+ * buttons in a group count scans of that group rather than DB_Update calls.
+ * Note: once groups are attached, only buttons inside a group are scanned.
+ *   Groups must not overlap. Encoders are always scanned on every call.
+ * ex:
+ * DB_Group groups[] = {
+ *   {.first = 0, .count = 8, .divider = 1},  // fast buttons, every call
+ *   {.first = 8, .count = 4, .divider = 20}  // DIP switches, every 20th call
+ * };
+ * DB_Init_Groups(&db, groups, 2);
+ *
+ * Single buttons can also be slowed down with their prescale field, which
+ * reads and integrates the button only every 2^prescale scans. Buttons with
+ * the same prescale are spread over different scans by index, so slow reads
+ * (for example through an I/O expander) do not all land on the same call.
+ * As with groups, the threshold counts the button's own samples.
+ * ex:
+ * DB_Button buttons[] = {
+ *   {.pin = 4, .threshold = 20},
+ *   {.pin = 40, .threshold = 4, .prescale = 3} // every 8th scan
+ * };
+ */
+
+/*
+ * Asynchronous banks:
+ * Buttons behind an I2C or SPI I/O expander can be read one expander at a
+ * time without blocking DB_Update on the bus. Give the group covering the
+ * expander's buttons a start function. When the group is due, DB_Update
+ * calls it to begin one bus read for the whole expander and returns
+ * immediately. The bus driver then passes the port value to
+ * DB_Bank_Complete, from DMA or an ISR. The next time the group is due, the
+ * completed value is fed into every button of the group, and the next read
+ * is started. A read still in flight is simply skipped.
+ * A read that will never complete (bus NAK, DMA error) leaves its group
+ * frozen until the driver calls DB_Bank_Abort, for example from its error
+ * callback. The group's buttons keep their state and a new read is started
+ * the next time the group is due.
+ * The pin ID of a banked button selects its bit in the port value (pin % 32).
+ * Note: DB_Init still reads every pin through the DB_GPIO_Read function once,
+ *   so it must be able to read expander pins synchronously.
+ * ex:
+ * void Expander_Start(void *ctx, uint8_t group) {
+ *   expander_group = group;
+ *   HAL_I2C_Mem_Read_DMA(&hi2c1, EXP_ADDR, EXP_INPUT_REG, 1, exp_rx, 2);
+ * }
+ * void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c) {
+ *   DB_Bank_Complete(&db, expander_group, exp_rx[0] | (exp_rx[1] << 8));
+ * }
+ * DB_Group groups[] = {
+ *   {.first = 0, .count = 8},
+ *   {.first = 8, .count = 16, .start = Expander_Start}
+ * };
+ */
+
+/*
+ * Oversampled ports:
+ * On electrically noisy lines a group can read its whole port several times
+ * per scan and feed the majority value of each pin into the integrators, so
+ * single EMI spikes never reach the counters. Give the group a port function
+ * returning the port value (pin % 32 selects the bit, as for banks) and an
+ * oversample count of up to DB_MAX_OVERSAMPLE reads. The vote is computed
+ * bitwise over whole port words, a few operations per read for every pin of
+ * the port. Use odd counts; ties count as low. Drivers collecting samples
+ * themselves, for example by DMA into an asynchronous bank, can vote with
+ * DB_Majority before calling DB_Bank_Complete.
+ * ex:
+ * DB_Word Port_B(void *ctx, uint8_t group) {
+ *   return GPIOB->IDR;
+ * }
+ * DB_Group groups[] = {
+ *   {.first = 0, .count = 16, .port = Port_B, .oversample = 5}
+ * };
+ */
+
+/*
+ * Button pool:
+ * Handles initialized with DB_Init_Pool start empty and hold up to capacity
+ * buttons that can be attached and detached at runtime, for example when a
+ * hot-pluggable input module is connected. Attaching takes a free slot in
+ * O(1) and only reads the new button's pin; every other button keeps its
+ * integrator state. DB_Attach returns the slot index, which is also the idx
+ * reported in events and used by the DB_*_Idx functions.
+ * ex:
+ * DB_Button *slots[16];
+ * uint8_t free_slots[16];
+ * DB_Init_Pool(&db, slots, free_slots, 16, Read_GPIO, NULL);
+ * int slot = DB_Attach(&db, &module_buttons[0]); // -1 if the pool is full
+ * ...
+ * DB_Detach(&db, slot);
+ */
+
+/*
+ * Wide counters:
+ * Thresholds and counters are 8 bits wide by default, which limits the
+ * debounce window to 255 DB_Update calls. Building with
+ * DB_CONFIG_WIDE_COUNTERS defined makes them 16 bits wide, for long debounce
+ * windows at high scan rates. DB_MAX_THRESHOLD holds the largest threshold
+ * for the current build. The packed layout keeps its 5-bit counter either
+ * way.
+ * Note: the setting must be the same for debounce.c and every file including
+ *   this header.
+ */
+
+/*
+ * Feature stripping:
+ * Features a firmware does not use can be compiled out of debounce.c to save
+ * flash and remove work from every update.
+ * DB_CONFIG_NO_CALLBACKS removes the cb and handlers fields, the callback
+ *   paths of buttons, virtual buttons and encoders, and DB_Init_Handlers.
+ *   The cb argument of the DB_Init functions is ignored.
+ * DB_CONFIG_NO_EDGE_LATCHES stops latching edge flags into button state and
+ *   removes DB_Rising, DB_Falling, DB_Changed and their _Idx equivalents.
+ *   Edges remain available through callbacks, edge bitmaps and the dirty
+ *   list.
+ * DB_CONFIG_NO_ENCODERS, DB_CONFIG_NO_GROUPS, DB_CONFIG_NO_POOL,
+ *   DB_CONFIG_NO_VIRTUAL and DB_CONFIG_NO_HISTORY remove rotary encoders,
+ *   scan groups and banks, the pool layout, virtual buttons and sample
+ *   histories: their DB_Handle fields, their functions and their checks in
+ *   DB_Update. With all seven options a handle holds only the button
+ *   tables, optional bitmaps and dirty list, and the scan bookkeeping.
+ * Note: like DB_CONFIG_WIDE_COUNTERS, these must be the same for debounce.c
+ *   and every file including this header.
+ */
+
+/*
+ * Warm restart:
+ * The integrator state of a handle (counters, current states and latched
+ * edge flags of every button and encoder) can be saved to a buffer, for
+ * example in retained RAM or a file, and restored after a soft reset or
+ * process restart so in-flight bounce and unread edges survive. Packed and
+ * split handles are saved and restored with a single memcpy.
+ * Snapshots are checked against the layout, button count and configuration
+ * of the handle they are restored into, and rejected if anything differs.
+ * Edge bitmaps and the dirty list are not saved. Virtual buttons are not
+ * saved either: DB_Restore re-evaluates them from the restored inputs
+ * without raising events, so attach them before restoring. Attached
+ * histories are refilled with the restored states, as by DB_Init_History.
+ * ex:
+ * __attribute__((section(".noinit"))) uint8_t retained[64];
+ * DB_Init(&db, buttons, count, Read_GPIO, NULL);
+ * if (!DB_Restore(&db, retained, sizeof(retained))) {
+ *   // cold start, keep the state read by DB_Init
+ * }
+ * ...
+ * DB_Save(&db, retained, sizeof(retained)); // before resetting
+ */
+
+/*
+ * Profiling:
+ * Building with DB_CONFIG_PROFILE defined records the cycle count of every
+ * DB_Update call and of every user callback into the prof_update and
+ * prof_callback accumulators of the handle. Update times include the
+ * callbacks they run. Profiling is compiled out by default.
+ *
+ * Cycles are read from DWT->CYCCNT on Cortex-M3 and up, rdtsc on x86 and
+ * clock_gettime (nanoseconds) elsewhere. Define DB_CYCLES() when building
+ * debounce.c to use another source.
+ * Note: on Cortex-M the cycle counter must be enabled by your startup code
+ *   (CoreDebug->DEMCR |= TRCENA, DWT->CTRL |= CYCCNTENA).
+ * ex:
+ * uint32_t worst = db.prof_update.max;
+ * uint32_t mean = DB_Profile_Mean(&db.prof_update);
+ * DB_Profile_Reset(&db.prof_update);
  */
 
 #define EVENT_QUEUE_SIZE 8
@@ -108,6 +481,79 @@
 extern "C" {
 #endif
 
+#ifndef DB_FLASH
+#define DB_FLASH
+#endif
+
+#ifndef DB_FLASH_RD
+#define DB_FLASH_RD(x) (x)
+#endif
+
+/*
+ * Counter and threshold types. DB_Count is used in DB_Button and DB_Encoder,
+ * DB_Count_Store in the dense DB_Config and DB_State arrays.
+ */
+#ifdef DB_CONFIG_WIDE_COUNTERS
+typedef uint_fast16_t DB_Count;
+typedef uint16_t DB_Count_Store;
+#define DB_MAX_THRESHOLD 65535
+#else
+typedef uint_fast8_t DB_Count;
+typedef uint8_t DB_Count_Store;
+#define DB_MAX_THRESHOLD 255
+#endif
+
+/*
+ * Word type of packed per-button bitmaps, and the number of words needed to
+ * hold n buttons.
+ */
+typedef uint32_t DB_Word;
+#define DB_WORD_BITS 32
+#define DB_WORDS(n) (((n) + DB_WORD_BITS - 1) / DB_WORD_BITS)
+
+#ifdef DB_CONFIG_PROFILE
+#ifndef DB_PROFILE_BINS
+#define DB_PROFILE_BINS 24
+#endif
+
+/*
+ * Cycle count accumulator.
+ *
+ * uint32_t min, max: Shortest and longest recorded sample.
+ *
+ * uint64_t sum: Sum of all samples, used for the mean.
+ *
+ * uint32_t count: Number of samples.
+ *
+ * uint32_t hist[DB_PROFILE_BINS]: Log2 histogram, bin b counts samples of
+ *   2^b to 2^(b+1)-1 cycles. The last bin also counts anything longer.
+ */
+typedef struct {
+	uint32_t min;
+	uint32_t max;
+	uint64_t sum;
+	uint32_t count;
+	uint32_t hist[DB_PROFILE_BINS];
+} DB_Profile;
+#endif
+
+/*
+ * Per-button sample history.
+ */
+#ifdef DB_CONFIG_HISTORY_64
+typedef uint64_t DB_History;
+#define DB_HISTORY_BITS 64
+#else
+typedef uint32_t DB_History;
+#define DB_HISTORY_BITS 32
+#endif
+
+/*
+ * Largest button prescale. The scan counters are 16 bits wide, so longer
+ * periods would not divide their wrap.
+ */
+#define DB_MAX_PRESCALE 15
+
 /*
  * Represents a mechanical button accessed through GPIO.
  *
@@ -115,38 +561,225 @@ extern "C" {
  *   will be read by the DB_GPIO_Read function provided by the user in
  *   DB_Handle.
  *
- * const uint_fast8_t threshold: The threshold required to change the debounced
+ * const DB_Count threshold: The threshold required to change the debounced
  *   state of the DB_Button. Higher values respond more slowly, but are more
  *   tolerant to chatter and noise.
+ *
+ * const uint8_t prescale: The button is sampled every 2^prescale scans.
+ *   Leave at 0 to sample on every scan. Values above DB_MAX_PRESCALE are
+ *   treated as DB_MAX_PRESCALE.
  */
 typedef struct {
 	// user-defined
 	const uint8_t pin;
-	const uint_fast8_t threshold;
+	const DB_Count threshold;
+	const uint8_t prescale;
 
 	// private
-	uint_fast8_t _counter;
+	DB_Count _counter;
 	uint8_t _state;
 } DB_Button;
 
+/*
+ * Read-only configuration of a button in the packed and split layouts.
+ *
+ * uint8_t pin: An integer pin ID, as in DB_Button.
+ *
+ * DB_Count_Store threshold: The debounce threshold, as in DB_Button.
+ *
+ * uint8_t prescale: The sampling prescaler, as in DB_Button.
+ */
+typedef struct {
+	uint8_t pin;
+	DB_Count_Store threshold;
+	uint8_t prescale;
+} DB_Config;
+
+/*
+ * Mutable state of a button in the packed layout.
+ * 0bcccccabc: the upper five bits hold the integrator counter and the lower
+ * three bits hold the same flags as DB_Button's _state.
+ */
+typedef uint8_t DB_Packed;
+
+#define DB_PACKED_MAX_THRESHOLD 31
+
+/*
+ * Mutable state of a button in the split layout.
+ */
+typedef struct {
+	DB_Count_Store _counter;
+	uint8_t _state;
+} DB_State;
+
+/*
+ * Storage layouts a DB_Handle can be initialized with.
+ */
+typedef enum {
+	DB_LAYOUT_BUTTON,
+	DB_LAYOUT_PACKED,
+	DB_LAYOUT_SPLIT,
+	DB_LAYOUT_POOL
+} DB_Layout;
+
+/*
+ * Largest encoder detent, limited by the signed 8-bit transition count.
+ */
+#define DB_MAX_DETENT 127
+
+/*
+ * Represents a quadrature rotary encoder accessed through two GPIO pins.
+ *
+ * const uint8_t pin_a, pin_b: Pin IDs of the A and B channels, read by the
+ *   DB_GPIO_Read function in DB_Handle.
+ *
+ * const DB_Count threshold: The threshold used to debounce each channel.
+ *
+ * const uint8_t detent: Number of quadrature transitions per reported step,
+ *   up to DB_MAX_DETENT. 0 is treated as 4, larger values as DB_MAX_DETENT.
+ */
+typedef struct {
+	// user-defined
+	const uint8_t pin_a;
+	const uint8_t pin_b;
+	const DB_Count threshold;
+	const uint8_t detent;
+
+	// private
+	DB_Count _counter_a;
+	DB_Count _counter_b;
+	uint8_t _state_a;
+	uint8_t _state_b;
+	int8_t _dir;
+	int8_t _sub;
+	int16_t _steps;
+	int32_t _position;
+} DB_Encoder;
+
+/*
+ * A function pointer to a user-defined function that starts an asynchronous
+ *   read of a bank of pins for the group with the given index. The read is
+ *   finished by calling DB_Bank_Complete.
+ */
+typedef void (*DB_Bank_Start)(void *ctx, uint8_t group);
+
+/*
+ * Synchronous read of a whole port for a scan group. Returns the port value
+ * with bit (pin % 32) holding the level of each pin.
+ */
+typedef DB_Word (*DB_Port_Read)(void *ctx, uint8_t group);
+
+/*
+ * Largest number of port reads voted on per scan.
+ */
+#define DB_MAX_OVERSAMPLE 15
+
+/*
+ * A contiguous range of buttons scanned at a reduced rate.
+ *
+ * const uint8_t first: Index of the first button in the group.
+ *
+ * const uint8_t count: Number of buttons in the group.
+ *
+ * const uint8_t divider: The group is scanned on every divider-th DB_Update
+ *   call. 0 and 1 both scan on every call.
+ *
+ * const DB_Bank_Start start: Starts an asynchronous read of the group's
+ *   bank, or NULL to read each pin through the handle's DB_GPIO_Read.
+ *
+ * void *const ctx: User context passed to start and port.
+ *
+ * const DB_Port_Read port: Reads the group's port in one call, or NULL. Used
+ *   when start is NULL.
+ *
+ * const uint8_t oversample: Number of port reads per scan, voted bitwise
+ *   into one sample per pin. 0 and 1 both read once.
+ */
+typedef struct {
+	// user-defined
+	const uint8_t first;
+	const uint8_t count;
+	const uint8_t divider;
+	const DB_Bank_Start start;
+	void *const ctx;
+	const DB_Port_Read port;
+	const uint8_t oversample;
+
+	// private
+	uint8_t _phase;
+	uint16_t _scans;
+	volatile uint8_t _bank;
+	volatile DB_Word _sample;
+} DB_Group;
+
+/*
+ * Boolean operators combining the inputs of a virtual button.
+ */
+typedef enum {
+	DB_VIRT_AND,
+	DB_VIRT_OR
+} DB_Virtual_Op;
+
+/*
+ * A virtual button derived from the debounced states of other buttons.
+ *
+ * const uint8_t *inputs: Indices of the input buttons.
+ *
+ * uint8_t count: Number of inputs, at most DB_WORD_BITS.
+ *
+ * DB_Word invert: Bit k inverts input k before it is combined.
+ *
+ * DB_Virtual_Op op: How the inputs are combined.
+ *
+ * DB_Button btn: Holds the state and edge flags of the virtual button. Its
+ *   pin and threshold are unused.
+ */
+typedef struct {
+	// user-defined
+	const uint8_t *const inputs;
+	const uint8_t count;
+	const DB_Word invert;
+	const DB_Virtual_Op op;
+
+	// private
+	DB_Button btn;
+	DB_Word _deps;
+} DB_Virtual;
+
 /*
  * Contains all possible button event types.
  */
 typedef enum {
 	DB_RISING_EDGE,
-	DB_FALLING_EDGE
+	DB_FALLING_EDGE,
+	DB_ENC_CW,
+	DB_ENC_CCW
 } DB_Event_Type;
 
 /*
  * Represents a single button event for a given button.
  *
  * const DB_Button *btn: a pointer to the button where the event occurred.
+ *   NULL for encoder events and for packed and split handles. For virtual
+ *   buttons it points at the btn member of the DB_Virtual.
  *
  * const DB_Event_Type ev_type: The type of button event that occurred.
+ *
+ * DB_Encoder *enc: a pointer to the encoder that stepped. NULL for button
+ *   events.
+ *
+ * uint8_t idx: the index of the button in the handle, or of the encoder or
+ *   virtual button in its array.
+ *
+ * DB_Virtual *virt: a pointer to the virtual button that changed. NULL for
+ *   other events.
  */
 typedef struct {
 	DB_Button *btn;
 	DB_Event_Type ev_type;
+	DB_Encoder *enc;
+	uint8_t idx;
+	DB_Virtual *virt;
 } DB_Event;
 
 /*
@@ -162,6 +795,39 @@ typedef bool (*DB_GPIO_Read)(uint8_t pin);
  */
 typedef void (*DB_Event_Callback)(DB_Event ev);
 
+/*
+ * A function pointer to a user-defined deadline check for DB_Update_Budget,
+ *   returning true once the time slice is used up.
+ */
+typedef bool (*DB_Deadline)(void);
+
+/*
+ * A function pointer to a user-defined per-button event handler that takes
+ *   in a DB_Event struct and the context pointer of its DB_Handler entry.
+ */
+typedef void (*DB_Handler_Callback)(DB_Event ev, void *ctx);
+
+/*
+ * An entry of a per-button handler table.
+ *
+ * DB_Handler_Callback fn: Handler for this button's events, or NULL to use
+ *   the handle's DB_Event_Callback.
+ *
+ * void *ctx: User context passed to fn.
+ */
+typedef struct {
+	DB_Handler_Callback fn;
+	void *ctx;
+} DB_Handler;
+
+struct DB_Handle;
+
+/*
+ * Routine that updates the buttons with indices in [first, end) of a handle,
+ * from the bank word if not NULL.
+ */
+typedef void (*DB_Kernel)(struct DB_Handle *db, int first, int end, uint16_t tick, const DB_Word *bank);
+
 /*
  * Debouncer handle, used to keep track of buttons and update debounced states.
  *
@@ -174,13 +840,134 @@ typedef void (*DB_Event_Callback)(DB_Event ev);
  *   the platform's GPIO driver.
  *
  * DB_Event_Callback: Function pointer to user-defind event manager. Set to
- *   NULL to disable callbacks.
+ *   NULL to disable callbacks. Absent with DB_CONFIG_NO_CALLBACKS.
+ *
+ * DB_Encoder *encs: An array of DB_Encoder structures, or NULL if no encoders
+ *   are attached.
+ *
+ * uint8_t enc_count: The number of DB_Encoder structures in the encs array.
+ *   encs and enc_count are absent with DB_CONFIG_NO_ENCODERS.
+ *
+ * const DB_Config *cfg: Button configuration table for packed and split
+ *   handles, NULL otherwise.
+ *
+ * DB_Packed *packed: Button state array for packed handles, NULL otherwise.
+ *
+ * DB_State *states: Button state array for split handles, NULL otherwise.
+ *
+ * DB_Layout layout: The storage layout the handle was initialized with.
+ *
+ * DB_Group *groups: An array of scan groups, or NULL to scan every button on
+ *   every call.
+ *
+ * uint8_t group_count: The number of DB_Group structures in the groups array.
+ *   groups and group_count are absent with DB_CONFIG_NO_GROUPS.
+ *
+ * DB_Button **slots: Slot table for pool handles, NULL otherwise. Empty
+ *   slots are NULL.
+ *
+ * uint8_t *free_slots: Stack of free slot indices for pool handles.
+ *
+ * uint8_t free_count: Number of entries on the free_slots stack.
+ *   slots, free_slots and free_count are absent with DB_CONFIG_NO_POOL.
+ *
+ * const DB_Handler *handlers: Per-button handler table indexed by button
+ *   index, or NULL to send every event to cb. Absent with
+ *   DB_CONFIG_NO_CALLBACKS.
+ *
+ * DB_Word *state_bits: Bitmap of debounced states, or NULL if not attached.
+ *
+ * DB_Word *rise_bits, *fall_bits: Bitmaps of latched rising and falling
+ *   edges, or NULL if not attached.
+ *
+ * uint8_t *dirty: Indices of buttons changed by the last DB_Update call, or
+ *   NULL if not attached.
+ *
+ * uint8_t dirty_count: Number of entries in the dirty list.
+ *
+ * uint16_t tick: Number of scans of ungrouped handles, used by prescalers.
+ *
+ * uint8_t cursor: Index of the next button DB_Update_Budget will update.
+ *
+ * bool shared: Set by DB_Init when buttons share pins, so each pin is read
+ *   once per DB_Update or DB_Update_Budget call, across all groups. Not
+ *   detected for pool handles.
+ *
+ * struct DB_Pin_Cache *pins: Pin levels read so far by the running update
+ *   when shared is set, NULL between updates.
+ *
+ * DB_Virtual *virts: An array of virtual buttons, or NULL if none are
+ *   attached.
+ *
+ * uint8_t virt_count: The number of DB_Virtual structures in virts.
+ *
+ * DB_Word changed: Hash of the buttons changed since virtual buttons were
+ *   last evaluated, bit (idx % DB_WORD_BITS) per button. virts, virt_count
+ *   and changed are absent with DB_CONFIG_NO_VIRTUAL.
+ *
+ * DB_History *history: Per-button sample histories, or NULL if not attached.
+ *
+ * bool history_raw: Record raw pin samples instead of debounced states.
+ *   history and history_raw are absent with DB_CONFIG_NO_HISTORY.
+ *
+ * DB_Kernel kernel: Scan routine specialised for the handle's layout,
+ *   consumers, thresholds and prescalers. Selected again by every DB_Init
+ *   function, so fields changed by hand afterwards are not taken into
+ *   account until the next one.
+ *
+ * DB_Profile prof_update, prof_callback: Cycle counts of DB_Update calls and
+ *   user callbacks. Only present with DB_CONFIG_PROFILE.
  */
-typedef struct {
+typedef struct DB_Handle {
 	DB_Button *btns;
 	uint8_t count;
 	DB_GPIO_Read rd;
+#ifndef DB_CONFIG_NO_CALLBACKS
 	DB_Event_Callback cb;
+#endif
+#ifndef DB_CONFIG_NO_ENCODERS
+	DB_Encoder *encs;
+	uint8_t enc_count;
+#endif
+	const DB_Config *cfg;
+	DB_Packed *packed;
+	DB_State *states;
+	DB_Layout layout;
+#ifndef DB_CONFIG_NO_GROUPS
+	DB_Group *groups;
+	uint8_t group_count;
+#endif
+#ifndef DB_CONFIG_NO_POOL
+	DB_Button **slots;
+	uint8_t *free_slots;
+	uint8_t free_count;
+#endif
+#ifndef DB_CONFIG_NO_CALLBACKS
+	const DB_Handler *handlers;
+#endif
+	DB_Word *state_bits;
+	DB_Word *rise_bits;
+	DB_Word *fall_bits;
+	uint8_t *dirty;
+	uint8_t dirty_count;
+	uint16_t tick;
+	uint8_t cursor;
+	bool shared;
+	struct DB_Pin_Cache *pins;
+#ifndef DB_CONFIG_NO_VIRTUAL
+	DB_Virtual *virts;
+	uint8_t virt_count;
+	DB_Word changed;
+#endif
+#ifndef DB_CONFIG_NO_HISTORY
+	DB_History *history;
+	bool history_raw;
+#endif
+	DB_Kernel kernel;
+#ifdef DB_CONFIG_PROFILE
+	DB_Profile prof_update;
+	DB_Profile prof_callback;
+#endif
 } DB_Handle;
 
 /*
@@ -188,6 +975,119 @@ typedef struct {
  */
 void DB_Init(DB_Handle *db, DB_Button *buttons, uint8_t count, DB_GPIO_Read rd, DB_Event_Callback cb);
 
+/*
+ * Initialize a handle using the packed layout. cfg and state must both hold
+ * count entries, and every threshold must be between 1 and
+ * DB_PACKED_MAX_THRESHOLD.
+ */
+void DB_Init_Packed(DB_Handle *db, const DB_Config *cfg, DB_Packed *state, uint8_t count, DB_GPIO_Read rd, DB_Event_Callback cb);
+
+/*
+ * Initialize a handle using the split layout. cfg and state must both hold
+ * count entries, and thresholds must not equal 0.
+ */
+void DB_Init_Split(DB_Handle *db, const DB_Config *cfg, DB_State *state, uint8_t count, DB_GPIO_Read rd, DB_Event_Callback cb);
+
+#ifndef DB_CONFIG_NO_POOL
+/*
+ * Initialize an empty handle using the pool layout. slots and free_slots must
+ * both hold capacity entries.
+ */
+void DB_Init_Pool(DB_Handle *db, DB_Button **slots, uint8_t *free_slots, uint8_t capacity, DB_GPIO_Read rd, DB_Event_Callback cb);
+
+/*
+ * Attach a button to a free slot of a pool handle, seeding its state from a
+ * single read of its pin. Returns the slot index, or -1 if the pool is full.
+ */
+int DB_Attach(DB_Handle *db, DB_Button *btn);
+
+/*
+ * Detach the button in a slot of a pool handle and return the slot to the
+ * pool. Edges of the button not yet taken with DB_Fetch_Edges are dropped.
+ * Detaching an empty slot does nothing.
+ */
+void DB_Detach(DB_Handle *db, uint8_t slot);
+#endif
+
+#ifndef DB_CONFIG_NO_GROUPS
+/*
+ * Attach an array of scan groups to an initialized DB_Handle. Every group is
+ * scanned on the next DB_Update call, then at its own divider.
+ */
+void DB_Init_Groups(DB_Handle *db, DB_Group *groups, uint8_t count);
+
+/*
+ * Complete the asynchronous bank read of a group with the pin levels of the
+ * bank. May be called from an ISR, or from inside the group's start function.
+ */
+void DB_Bank_Complete(DB_Handle *db, uint8_t group, DB_Word bits);
+
+/*
+ * Abandon the asynchronous bank read of a group, so the next read is started
+ * the next time the group is due. May be called from an ISR. The aborted
+ * transfer must not call DB_Bank_Complete afterwards.
+ * ex:
+ * void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c) {
+ *   DB_Bank_Abort(&db, expander_group);
+ * }
+ */
+void DB_Bank_Abort(DB_Handle *db, uint8_t group);
+#endif
+
+/*
+ * Returns the bitwise majority of count port samples (up to
+ * DB_MAX_OVERSAMPLE): bit n is set if more than half of the samples have
+ * bit n set.
+ * ex:
+ * DB_Bank_Complete(&db, group, DB_Majority(dma_rx, 5));
+ */
+DB_Word DB_Majority(const DB_Word *samples, uint8_t count);
+
+#ifndef DB_CONFIG_NO_VIRTUAL
+/*
+ * Attach an array of virtual buttons to an initialized DB_Handle and
+ * evaluate their initial state. No events are raised for the initial state.
+ */
+void DB_Init_Virtual(DB_Handle *db, DB_Virtual *virts, uint8_t count);
+#endif
+
+#ifndef DB_CONFIG_NO_HISTORY
+/*
+ * Attach per-button histories of count entries (capacity for pool handles)
+ * to an initialized DB_Handle, filled with each button's current state.
+ * With raw set, pin samples are recorded instead of debounced states.
+ */
+void DB_Init_History(DB_Handle *db, DB_History *history, bool raw);
+#endif
+
+/*
+ * Attach a per-button handler table to an initialized DB_Handle. The table
+ * must hold one entry per button index (the capacity for pool handles).
+ * Pass NULL to detach it.
+ */
+#ifndef DB_CONFIG_NO_CALLBACKS
+void DB_Init_Handlers(DB_Handle *db, const DB_Handler *handlers);
+#endif
+
+/*
+ * Attach a state bitmap of DB_WORDS(count) words to an initialized
+ * DB_Handle (capacity for pool handles) and fill it with the current
+ * debounced states.
+ */
+void DB_Init_Bitmap(DB_Handle *db, DB_Word *state_bits);
+
+/*
+ * Attach cleared rising and falling edge bitmaps of DB_WORDS(count) words
+ * each to an initialized DB_Handle (capacity for pool handles).
+ */
+void DB_Init_Edge_Bitmaps(DB_Handle *db, DB_Word *rise_bits, DB_Word *fall_bits);
+
+/*
+ * Attach a dirty list of count entries (capacity for pool handles) to an
+ * initialized DB_Handle.
+ */
+void DB_Init_Dirty(DB_Handle *db, uint8_t *dirty);
+
 /*
  * Update each button's state using DB_Handle's user-defined GPIO reader.
  * Performs event callbacks and sets rising and falling edge flags for
@@ -197,6 +1097,16 @@ void DB_Init(DB_Handle *db, DB_Button *buttons, uint8_t count, DB_GPIO_Read rd,
  */
 void DB_Update(DB_Handle *db);
 
+/*
+ * Update up to max buttons (0 for no limit), starting where the previous call
+ * stopped, and stop early once expired returns true (NULL for no deadline).
+ * At least one button is updated per call, and no button is updated twice
+ * in one call. Returns true if the call completed a pass over all buttons.
+ *
+ * Do not mix with DB_Update on the same handle. NOT ISR or thread safe.
+ */
+bool DB_Update_Budget(DB_Handle *db, uint8_t max, DB_Deadline expired);
+
 /*
  * Return the debounced state of a button as a boolean value. Returned state
  * will reflect the button state during the last DB_Update call.
@@ -205,6 +1115,7 @@ void DB_Update(DB_Handle *db);
  */
 bool DB_Rd(const DB_Button *btn);
 
+#ifndef DB_CONFIG_NO_EDGE_LATCHES
 /*
  * Returns true if the debounced state of the button has gone from false to
  * true since the last DB_Rising call.
@@ -232,6 +1143,116 @@ bool DB_Falling(DB_Button *btn);
  * bool x = DB_Falling(&buttons[1]);
  */
 bool DB_Changed(DB_Button *btn);
+#endif
+
+/*
+ * Index based equivalents of DB_Rd, DB_Rising, DB_Falling and DB_Changed.
+ * These work on any handle, and are the only way to access buttons in a
+ * packed or split handle.
+ * ex:
+ * bool x = DB_Rising_Idx(&db, 1);
+ */
+bool DB_Rd_Idx(const DB_Handle *db, uint8_t idx);
+#ifndef DB_CONFIG_NO_EDGE_LATCHES
+bool DB_Rising_Idx(DB_Handle *db, uint8_t idx);
+bool DB_Falling_Idx(DB_Handle *db, uint8_t idx);
+bool DB_Changed_Idx(DB_Handle *db, uint8_t idx);
+#endif
+
+/*
+ * Returns the state bitmap attached with DB_Init_Bitmap. Returned states
+ * reflect the last DB_Update call.
+ */
+const DB_Word *DB_Rd_Bitmap(const DB_Handle *db);
+
+/*
+ * Atomically fetch and clear the edge bitmaps attached with
+ * DB_Init_Edge_Bitmaps, one word at a time. Either output may be NULL to
+ * leave that bitmap untouched. The per-button edge flags used by the polling
+ * functions are not affected.
+ * ex:
+ * DB_Fetch_Edges(&db, rising, falling);
+ */
+void DB_Fetch_Edges(DB_Handle *db, DB_Word *rising, DB_Word *falling);
+
+/*
+ * Returns the number of buttons whose debounced state changed during the last
+ * DB_Update call, and points list at their indices in scan order.
+ */
+uint8_t DB_Dirty(const DB_Handle *db, const uint8_t **list);
+
+#ifndef DB_CONFIG_NO_HISTORY
+/*
+ * History queries over the newest n recorded samples of a button (n is
+ * capped at DB_HISTORY_BITS). Require DB_Init_History. A window of n = 0
+ * holds no samples: DB_Held_Within and DB_Held_For return false and DB_Duty
+ * returns 0.
+ * DB_Held_Within: true if any of the samples was high.
+ * DB_Held_For: true if all of the samples were high.
+ * DB_Duty: the number of samples that were high.
+ * ex:
+ * bool long_press = DB_Held_For(&db, 0, 32);
+ */
+bool DB_Held_Within(const DB_Handle *db, uint8_t idx, uint8_t n);
+bool DB_Held_For(const DB_Handle *db, uint8_t idx, uint8_t n);
+uint8_t DB_Duty(const DB_Handle *db, uint8_t idx, uint8_t n);
+#endif
+
+/*
+ * Returns the number of bytes DB_Save needs for the handle.
+ */
+size_t DB_Snapshot_Size(const DB_Handle *db);
+
+/*
+ * Save the integrator state of every button and encoder into buf. Returns
+ * the number of bytes written, or 0 if len is too small.
+ */
+size_t DB_Save(const DB_Handle *db, void *buf, size_t len);
+
+/*
+ * Restore integrator state saved by DB_Save into an initialized handle with
+ * the same layout and configuration, and refresh the state bitmap if one is
+ * attached. Pool handles must have the same buttons attached to the same
+ * slots. Returns false, leaving the handle untouched, if the snapshot does
+ * not match.
+ */
+bool DB_Restore(DB_Handle *db, const void *buf, size_t len);
+
+#ifdef DB_CONFIG_PROFILE
+/*
+ * Clear a cycle count accumulator.
+ */
+void DB_Profile_Reset(DB_Profile *prof);
+
+/*
+ * Returns the mean of the samples in a cycle count accumulator, or 0 if it
+ * is empty.
+ */
+uint32_t DB_Profile_Mean(const DB_Profile *prof);
+#endif
+
+#ifndef DB_CONFIG_NO_ENCODERS
+/*
+ * Attach an array of encoders to an initialized DB_Handle. Both channels of
+ * every encoder are read once to seed the debounced state.
+ */
+void DB_Init_Encoders(DB_Handle *db, DB_Encoder *encoders, uint8_t count);
+
+/*
+ * Returns the signed number of steps the encoder has turned since the last
+ * DB_Enc_Steps call. Positive values are clockwise (A leading B).
+ * Clears the pending step count every time it is called.
+ * ex:
+ * int16_t x = DB_Enc_Steps(&encoders[0]);
+ */
+int16_t DB_Enc_Steps(DB_Encoder *enc);
+
+/*
+ * Returns the total number of signed steps the encoder has turned since
+ * DB_Init_Encoders.
+ */
+int32_t DB_Enc_Position(const DB_Encoder *enc);
+#endif
 
 
 #ifdef __cplusplus
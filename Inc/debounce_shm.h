@@ -0,0 +1,166 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <debounce.h>
+
+/*
+ * Shared memory publication for Linux and other POSIX systems.
+ *
+ * A single process owns the DB_Handle and publishes its debounced state and
+ * events into a POSIX shared memory segment. Any number of reader processes
+ * map the segment and consume it without system calls or GPIO access.
+ * The state bitmap is protected by a seqlock, and events go through a single
+ * producer, multiple consumer ring where every reader keeps its own position.
+ * A reader that falls more than a ring behind skips to the oldest event still
+ * in the ring, and the number of skipped events is added to its lost field.
+ *
+ * Publisher:
+ * The handle must have a state bitmap (DB_Init_Bitmap) and a dirty list
+ * (DB_Init_Dirty) attached. Call DB_Shm_Publish after every DB_Update.
+ * The segment may be created for more buttons than the handle has.
+ * ex:
+ * DB_Shm shm;
+ * if (DB_Shm_Create(&shm, "/buttons", count, 256) != 0) {
+ *   perror("DB_Shm_Create");
+ * }
+ * ...
+ * DB_Update(&db);
+ * DB_Shm_Publish(&shm, &db);
+ *
+ * Reader:
+ * ex:
+ * DB_Shm_Reader rd;
+ * DB_Shm_Open(&rd, "/buttons");
+ * DB_Word state[DB_WORDS(256)];
+ * DB_Shm_Read_State(&rd, state);
+ * DB_Shm_Event ev;
+ * while (DB_Shm_Next_Event(&rd, &ev)) {
+ *   // handle ev.idx, ev.ev_type
+ * }
+ */
+
+#ifndef INC_DEBOUNCE_SHM_H_
+#define INC_DEBOUNCE_SHM_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DB_SHM_MAGIC 0x44425348 // "DBSH"
+#define DB_SHM_VERSION 2
+
+/*
+ * A published button event.
+ *
+ * uint32_t tick: Number of DB_Shm_Publish calls before the one that
+ *   published the event.
+ *
+ * uint8_t idx: Index of the button in the publishing handle.
+ *
+ * uint8_t ev_type: DB_RISING_EDGE or DB_FALLING_EDGE.
+ */
+typedef struct {
+	uint32_t tick;
+	uint8_t idx;
+	uint8_t ev_type;
+} DB_Shm_Event;
+
+/*
+ * Header at the start of the shared memory segment. It is followed by the
+ * state bitmap and then the event ring.
+ */
+typedef struct {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t words;
+	uint32_t ring_size;
+	uint32_t seq;
+	uint64_t head;
+	uint32_t tick;
+	uint16_t count;
+} DB_Shm_Header;
+
+/*
+ * A slot of the event ring. seq is 2 * position + 2 once the event at that
+ * position is complete, and odd while it is being written.
+ */
+typedef struct {
+	uint64_t seq;
+	DB_Shm_Event ev;
+} DB_Shm_Slot;
+
+/*
+ * Publisher side of a segment.
+ */
+typedef struct {
+	DB_Shm_Header *hdr;
+	DB_Word *state;
+	DB_Shm_Slot *ring;
+	size_t size;
+} DB_Shm;
+
+/*
+ * Reader side of a segment.
+ *
+ * uint64_t pos: Position of the next event to read.
+ *
+ * uint64_t lost: Number of events skipped because the reader fell behind.
+ */
+typedef struct {
+	const DB_Shm_Header *hdr;
+	const DB_Word *state;
+	const DB_Shm_Slot *ring;
+	size_t size;
+	uint64_t pos;
+	uint64_t lost;
+} DB_Shm_Reader;
+
+/*
+ * Create (or replace) and map a segment for up to count buttons with an event
+ * ring of ring_size entries, rounded up to a power of two.
+ * Returns 0 on success, or -1 with errno set.
+ */
+int DB_Shm_Create(DB_Shm *shm, const char *name, uint16_t count, uint32_t ring_size);
+
+/*
+ * Publish the state bitmap and the events of the last DB_Update call.
+ * The handle and the segment may have different button counts: buttons past
+ * the segment's count are not published, and segment bits past the handle's
+ * count stay zero.
+ * Returns 0 on success, or -1 with errno set to EINVAL if the handle has no
+ * state bitmap.
+ */
+int DB_Shm_Publish(DB_Shm *shm, const DB_Handle *db);
+
+/*
+ * Unmap a segment, and remove its name if unlink is true.
+ */
+void DB_Shm_Close(DB_Shm *shm, const char *name, bool unlink);
+
+/*
+ * Map an existing segment for reading. New readers start at the newest
+ * event. Returns 0 on success, or -1 with errno set.
+ */
+int DB_Shm_Open(DB_Shm_Reader *rd, const char *name);
+
+/*
+ * Copy a consistent snapshot of the state bitmap into out, which must hold
+ * DB_WORDS(count) words. Returns the publish tick of the snapshot.
+ */
+uint32_t DB_Shm_Read_State(const DB_Shm_Reader *rd, DB_Word *out);
+
+/*
+ * Read the next event. Returns false if there are no new events.
+ */
+bool DB_Shm_Next_Event(DB_Shm_Reader *rd, DB_Shm_Event *ev);
+
+/*
+ * Unmap a segment opened with DB_Shm_Open.
+ */
+void DB_Shm_Close_Reader(DB_Shm_Reader *rd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INC_DEBOUNCE_SHM_H_ */
@@ -0,0 +1,143 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <debounce.h>
+
+/*
+ * Simulated GPIO backend for host testing and benchmarks.
+ *
+ * Each simulated pin is a DB_Sim_Switch model describing how its contacts
+ * misbehave: bounce after every actuation, chatter while bouncing, random
+ * EMI spikes, bounce that grows with wear, and contacts stuck at one level.
+ * All randomness comes from a seeded generator, so a run is reproducible
+ * as long as the same reads happen in the same order.
+ *
+ * 1. Define the switch models.
+ * Probabilities are out of 65536 per read, so 65535 is the closest to
+ * certain. Pin n of the simulator is switch n of the array.
+ * ex:
+ * DB_Sim_Switch switches[] = {
+ *   {.bounce = 10, .chatter = 32768},            // clean but bouncy
+ *   {.bounce = 4, .chatter = 20000, .emi = 50},  // noisy line
+ *   {.bounce = 2, .wear = 16},                   // bounce grows with use
+ *   {.stuck = DB_SIM_STUCK_HIGH}                 // welded contact
+ * };
+ *
+ * 2. Initialize the simulator and select it as the source for DB_Sim_Read.
+ * ex:
+ * DB_Sim sim;
+ * DB_Sim_Init(&sim, switches, 4, 1234);
+ * DB_Sim_Select(&sim);
+ * DB_Init(&db, buttons, count, DB_Sim_Read, NULL);
+ *
+ * 3. Drive the switches and advance time once per DB_Update call.
+ * ex:
+ * DB_Sim_Set(&sim, 0, true); // press
+ * for (int t = 0; t < 100; t++) {
+ *   DB_Sim_Tick(&sim);
+ *   DB_Update(&db);
+ * }
+ */
+
+#ifndef INC_DEBOUNCE_SIM_H_
+#define INC_DEBOUNCE_SIM_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DB_SIM_DEFAULT_CHATTER 32768 // bounce flips half of the reads
+
+/*
+ * Contact failures a simulated switch can have.
+ */
+typedef enum {
+	DB_SIM_STUCK_NONE,
+	DB_SIM_STUCK_LOW,
+	DB_SIM_STUCK_HIGH
+} DB_Sim_Stuck;
+
+/*
+ * Model of a single bouncing switch.
+ *
+ * uint16_t bounce: Number of ticks the contact bounces after each change of
+ *   its actuated level.
+ *
+ * uint16_t chatter: Probability that a read during bounce returns the
+ *   opposite of the new level. 0 selects DB_SIM_DEFAULT_CHATTER, so a
+ *   switch with bounce or wear set always bounces.
+ *
+ * uint16_t emi: Probability that any read returns the opposite of the
+ *   current level.
+ *
+ * uint16_t wear: Extra bounce ticks added per 256 actuations.
+ *
+ * DB_Sim_Stuck stuck: Forces every read to one level when set.
+ */
+typedef struct {
+	// user-defined
+	uint16_t bounce;
+	uint16_t chatter;
+	uint16_t emi;
+	uint16_t wear;
+	DB_Sim_Stuck stuck;
+
+	// private
+	bool _level;
+	uint32_t _settle;
+	uint32_t _actuations;
+} DB_Sim_Switch;
+
+/*
+ * Simulator state.
+ *
+ * DB_Sim_Switch *sw: The switch models, indexed by pin.
+ *
+ * uint16_t count: The number of switches in sw.
+ *
+ * uint32_t tick: Number of DB_Sim_Tick calls since DB_Sim_Init.
+ */
+typedef struct {
+	DB_Sim_Switch *sw;
+	uint16_t count;
+	uint32_t tick;
+	uint32_t _rng;
+} DB_Sim;
+
+/*
+ * Initialize a simulator. Every switch starts released and settled.
+ * A seed of 0 is replaced by a fixed non-zero seed.
+ */
+void DB_Sim_Init(DB_Sim *sim, DB_Sim_Switch *switches, uint16_t count, uint32_t seed);
+
+/*
+ * Select the simulator read by DB_Sim_Read.
+ */
+void DB_Sim_Select(DB_Sim *sim);
+
+/*
+ * Actuate a switch. Changing its level starts a bounce period.
+ */
+void DB_Sim_Set(DB_Sim *sim, uint16_t pin, bool level);
+
+/*
+ * Advance simulated time by one tick. Runs in O(1).
+ */
+void DB_Sim_Tick(DB_Sim *sim);
+
+/*
+ * Returns the actuated level of a switch, without bounce or noise. Useful as
+ * the ground truth when checking debounced output.
+ */
+bool DB_Sim_Level(const DB_Sim *sim, uint16_t pin);
+
+/*
+ * DB_GPIO_Read compatible reader for the selected simulator. Pins without a
+ * switch model read low.
+ */
+bool DB_Sim_Read(uint8_t pin);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INC_DEBOUNCE_SIM_H_ */
@@ -1,104 +1,1395 @@
+#if defined(DB_CONFIG_PROFILE) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 199309L
+#endif
+
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include <debounce.h>
 
+#ifdef DB_CONFIG_PROFILE
+#ifndef DB_CYCLES
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__) || defined(__ARM_ARCH_8M_MAIN__)
+#define DB_CYCLES() (*(volatile uint32_t *)0xE0001004u) // DWT->CYCCNT
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define DB_CYCLES() ((uint32_t)__rdtsc())
+#else
+#include <time.h>
+static inline uint32_t clock_cycles(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)ts.tv_sec * 1000000000u + (uint32_t)ts.tv_nsec;
+}
+#define DB_CYCLES() clock_cycles()
+#endif
+#endif
+
+static void profile_add(DB_Profile *prof, uint32_t cycles) {
+	int bin = 0;
+	while (bin < DB_PROFILE_BINS - 1 && (cycles >> (bin + 1)) != 0) {
+		bin++;
+	}
+	prof->hist[bin]++;
+	prof->min = (prof->count == 0 || cycles < prof->min) ? cycles : prof->min;
+	prof->max = (cycles > prof->max) ? cycles : prof->max;
+	prof->sum += cycles;
+	prof->count++;
+}
+
+#define PROFILE_START() uint32_t prof_start = DB_CYCLES()
+#define PROFILE_END(prof) profile_add((prof), DB_CYCLES() - prof_start)
+#else
+#define PROFILE_START()
+#define PROFILE_END(prof)
+#endif
+
 enum _state_bit_mask {
 	curr_state = 0x01,
 	falling_edge = 0x02,
 	rising_edge = 0x04
 };
 
+/*
+ * Edge bitmap primitives. The GCC/Clang builtins are only used where they
+ * compile to lock-free instructions for a DB_Word, so cores without 32-bit
+ * atomics (Cortex-M0/M0+) and other compilers never need libatomic. The plain
+ * fallbacks require DB_Update and DB_Fetch_Edges not to preempt each other.
+ */
+#if defined(__GNUC__) && ((__SIZEOF_INT__ == 4 && __GCC_ATOMIC_INT_LOCK_FREE == 2) \
+		|| (__SIZEOF_LONG__ == 4 && __GCC_ATOMIC_LONG_LOCK_FREE == 2))
+#define ATOMIC_BUILTINS 1
+#else
+#define ATOMIC_BUILTINS 0
+#endif
+
+#ifndef DB_ATOMIC_OR
+#if ATOMIC_BUILTINS
+#define DB_ATOMIC_OR(p, v) __atomic_fetch_or((p), (v), __ATOMIC_RELEASE)
+#else
+#define DB_ATOMIC_OR(p, v) (*(p) |= (v))
+#endif
+#endif
+
+#ifndef DB_ATOMIC_AND
+#if ATOMIC_BUILTINS
+#define DB_ATOMIC_AND(p, v) __atomic_fetch_and((p), (v), __ATOMIC_RELEASE)
+#else
+#define DB_ATOMIC_AND(p, v) (*(p) &= (v))
+#endif
+#endif
+
+#ifndef DB_ATOMIC_XCHG
+#if ATOMIC_BUILTINS
+#define DB_ATOMIC_XCHG(p, v) __atomic_exchange_n((p), (v), __ATOMIC_ACQUIRE)
+#else
+static inline DB_Word plain_xchg(DB_Word *p, DB_Word v) {
+	DB_Word old = *p;
+	*p = v;
+	return old;
+}
+#define DB_ATOMIC_XCHG(p, v) plain_xchg((p), (v))
+#endif
+#endif
+
+/*
+ * Edge bits latched into a button's flags for the polling functions.
+ */
+#ifdef DB_CONFIG_NO_EDGE_LATCHES
+#define LATCH(edge) ((edge) & 0)
+#else
+#define LATCH(edge) (edge)
+#endif
+
+#define PACKED_FLAGS 0x07
+#define PACKED_SHIFT 3
+
+enum _bank_state {
+	BANK_IDLE,
+	BANK_BUSY,
+	BANK_READY
+};
+
+#define SNAPSHOT_MAGIC 0x44425331 // "DBS1"
+
+/*
+ * Header of a DB_Save snapshot. It is followed by one record per button
+ * (a DB_Packed byte for packed handles, a DB_State otherwise) and one
+ * enc_record per encoder.
+ */
+typedef struct {
+	uint32_t magic;
+	uint32_t config_hash;
+	uint8_t layout;
+	uint8_t count;
+	uint8_t enc_count;
+	uint8_t record_size;
+} snapshot_header;
+
+typedef struct {
+	DB_Count_Store counter_a;
+	DB_Count_Store counter_b;
+	uint8_t state_a;
+	uint8_t state_b;
+	int8_t dir;
+	int8_t sub;
+	int16_t steps;
+	int32_t position;
+} enc_record;
+
+/*
+ * Quadrature transition table indexed by (previous AB << 2) | current AB,
+ * where A is bit 1 and B is bit 0. A value of 2 marks a skipped phase, where
+ * both channels changed between two DB_Update calls.
+ */
+#ifndef DB_CONFIG_NO_ENCODERS
+static const int8_t quadrature_table[16] = {
+	0, -1, 1, 2,
+	1, 0, 2, -1,
+	-1, 2, 0, 1,
+	2, 1, -1, 0
+};
+#endif
+
+/*
+ * Advance an integrator by a single sample and update the state flags.
+ * Returns the edge bit raised by this sample, or 0 if the debounced state did
+ * not change.
+ *
+ * The kernel is branchless: the counter clamp and the edge derivation are
+ * computed with comparisons and masks, so every sample takes the same time
+ * regardless of the input, counter or state. The result is identical to the
+ * nested form:
+ * in, counter < threshold:   counter++
+ * in, counter saturated:     set state, rising edge if it was clear
+ * !in, counter != 0:         counter--
+ * !in, counter at 0:         clear state, falling edge if it was set
+ */
+static inline uint8_t integrate(DB_Count *counter, DB_Count threshold, uint8_t *state, bool in) {
+	DB_Count c = *counter;
+	uint8_t s = *state;
+	uint8_t hi = in;
+	uint8_t lo = !in;
+	uint8_t at_top = (c >= threshold);
+	uint8_t at_bottom = (c == 0);
+
+	uint8_t set = hi & at_top;
+	uint8_t clr = lo & at_bottom;
+	uint8_t cur = s & curr_state;
+	uint8_t edge = (uint8_t)(((set & !cur) * rising_edge) | ((clr & cur) * falling_edge));
+
+	*counter = (DB_Count)(c + (hi & !at_top) - (lo & !at_bottom));
+	*state = (uint8_t)((s & ~curr_state) | ((cur | set) & !clr) | LATCH(edge));
+	return edge;
+}
+
+/*
+ * Set or clear bit idx of a packed bitmap.
+ */
+static inline void put_bit(DB_Word *words, uint8_t idx, bool value) {
+	DB_Word mask = (DB_Word)1 << (idx % DB_WORD_BITS);
+	if (value) {
+		words[idx / DB_WORD_BITS] |= mask;
+	}
+	else {
+		words[idx / DB_WORD_BITS] &= ~mask;
+	}
+}
+
+/*
+ * Raise a button event through the button's handler, or the handle's
+ * callback if the button has none.
+ */
+static inline void emit(DB_Handle *db, uint8_t idx, DB_Button *btn, uint8_t edge) {
+	if (db->state_bits != NULL) {
+		put_bit(db->state_bits, idx, edge == rising_edge);
+	}
+	if (db->rise_bits != NULL) {
+		DB_Word *edge_bits = (edge == rising_edge) ? db->rise_bits : db->fall_bits;
+		DB_ATOMIC_OR(&edge_bits[idx / DB_WORD_BITS], (DB_Word)1 << (idx % DB_WORD_BITS));
+	}
+	if (db->dirty != NULL) {
+		db->dirty[db->dirty_count++] = idx;
+	}
+#ifndef DB_CONFIG_NO_VIRTUAL
+	db->changed |= (DB_Word)1 << (idx % DB_WORD_BITS);
+#endif
+
+#ifndef DB_CONFIG_NO_CALLBACKS
+	DB_Handler_Callback fn = (db->handlers != NULL) ? db->handlers[idx].fn : NULL;
+	if (fn != NULL || db->cb != NULL) {
+		// event callback
+		DB_Event ev = {
+			.btn = btn,
+			.ev_type = (edge == rising_edge) ? DB_RISING_EDGE : DB_FALLING_EDGE,
+			.enc = NULL,
+			.idx = idx
+		};
+		PROFILE_START();
+		if (fn != NULL) {
+			fn(ev, db->handlers[idx].ctx);
+		}
+		else {
+			db->cb(ev);
+		}
+		PROFILE_END(&db->prof_callback);
+	}
+#else
+	(void)btn;
+#endif
+}
+
+/*
+ * Return a pointer to the flag byte of a button, for either layout. In the
+ * packed layout the flags share the byte with the counter, so callers must
+ * only touch the bits in PACKED_FLAGS.
+ */
+static inline uint8_t *flags_of(const DB_Handle *db, uint8_t idx) {
+	switch (db->layout) {
+	case DB_LAYOUT_PACKED:
+		return &db->packed[idx];
+	case DB_LAYOUT_SPLIT:
+		return &db->states[idx]._state;
+#ifndef DB_CONFIG_NO_POOL
+	case DB_LAYOUT_POOL:
+		return &db->slots[idx]->_state;
+#endif
+	default:
+		return &db->btns[idx]._state;
+	}
+}
+
+/*
+ * Return the DB_Button at idx of a legacy or pool handle, or NULL for an
+ * empty pool slot.
+ */
+static inline DB_Button *button_at(const DB_Handle *db, uint8_t idx) {
+#ifndef DB_CONFIG_NO_POOL
+	if (db->layout == DB_LAYOUT_POOL) {
+		return db->slots[idx];
+	}
+#endif
+	return &db->btns[idx];
+}
+
+/*
+ * Debounced state of idx, false for an empty pool slot.
+ */
+static inline bool state_at(const DB_Handle *db, uint8_t idx) {
+#ifndef DB_CONFIG_NO_POOL
+	if (db->layout == DB_LAYOUT_POOL && db->slots[idx] == NULL) {
+		return false;
+	}
+#endif
+	return DB_Rd_Idx(db, idx);
+}
+
+#ifndef DB_CONFIG_NO_EDGE_LATCHES
+/*
+ * Clear the given edge bits and return whether any of them were set.
+ */
+static inline bool take_edges(uint8_t *state, uint8_t mask) {
+	if ((*state & mask) != 0) {
+		*state = *state & ~mask;
+		return true;
+	}
+	return false;
+}
+#endif
+
+#ifndef DB_CONFIG_NO_VIRTUAL
+/*
+ * Combine the current states of a virtual button's inputs.
+ */
+static bool evaluate_virtual(const DB_Handle *db, const DB_Virtual *virt) {
+	bool all = true;
+	bool any = false;
+	for (int k = 0; k < virt->count; k++) {
+		bool in = state_at(db, virt->inputs[k]) ^ ((virt->invert >> k) & 1);
+		all = all && in;
+		any = any || in;
+	}
+	return (virt->op == DB_VIRT_AND) ? all : any;
+}
+
+/*
+ * Re-evaluate the virtual buttons depending on any button that changed since
+ * the last call, and raise events for those whose state changed.
+ */
+static void update_virtuals(DB_Handle *db) {
+	DB_Word changed = db->changed;
+	db->changed = 0;
+	if (changed == 0) {
+		return;
+	}
+	for (int v = 0; v < db->virt_count; v++) {
+		DB_Virtual *virt = &db->virts[v];
+		if ((virt->_deps & changed) == 0) {
+			continue;
+		}
+		bool in = evaluate_virtual(db, virt);
+		uint8_t cur = virt->btn._state & curr_state;
+		if (in == cur) {
+			continue;
+		}
+		uint8_t edge = in ? rising_edge : falling_edge;
+		virt->btn._state = (uint8_t)((virt->btn._state & ~curr_state) | in | LATCH(edge));
+#ifndef DB_CONFIG_NO_CALLBACKS
+		if (db->cb != NULL) {
+			// event callback
+			DB_Event ev = {
+				.btn = &virt->btn,
+				.ev_type = in ? DB_RISING_EDGE : DB_FALLING_EDGE,
+				.enc = NULL,
+				.idx = v,
+				.virt = virt
+			};
+			PROFILE_START();
+			db->cb(ev);
+			PROFILE_END(&db->prof_callback);
+		}
+#endif
+	}
+}
+#else
+static inline void update_virtuals(DB_Handle *db) {
+	(void)db;
+}
+#endif
+
+#ifndef DB_CONFIG_NO_ENCODERS
+static void update_encoder(DB_Handle *db, DB_Encoder *enc) {
+	uint8_t prev = ((enc->_state_a & curr_state) << 1) | (enc->_state_b & curr_state);
+	integrate(&enc->_counter_a, enc->threshold, &enc->_state_a, db->rd(enc->pin_a));
+	integrate(&enc->_counter_b, enc->threshold, &enc->_state_b, db->rd(enc->pin_b));
+	uint8_t next = ((enc->_state_a & curr_state) << 1) | (enc->_state_b & curr_state);
+
+	int8_t delta = quadrature_table[(prev << 2) | next];
+	if (delta == 2) {
+		delta = 2 * enc->_dir; // skipped phase, assume the last known direction
+	}
+	else if (delta != 0) {
+		enc->_dir = delta;
+	}
+
+	// sum in an int, a detent of DB_MAX_DETENT may briefly overshoot int8_t
+	int sub = enc->_sub + delta;
+	int detent = (enc->detent == 0) ? 4 : (enc->detent > DB_MAX_DETENT) ? DB_MAX_DETENT : enc->detent;
+	while (sub >= detent || sub <= -detent) {
+		int8_t step = (sub > 0) ? 1 : -1;
+		sub -= step * detent;
+		enc->_steps += step;
+		enc->_position += step;
+#ifndef DB_CONFIG_NO_CALLBACKS
+		if (db->cb != NULL) {
+			// event callback
+			DB_Event ev = {
+				.btn = NULL,
+				.ev_type = (step > 0) ? DB_ENC_CW : DB_ENC_CCW,
+				.enc = enc,
+				.idx = (uint8_t)(enc - db->encs)
+			};
+			PROFILE_START();
+			db->cb(ev);
+			PROFILE_END(&db->prof_callback);
+		}
+#endif
+	}
+	enc->_sub = (int8_t)sub;
+}
+
+static void update_encoders(DB_Handle *db) {
+	for (int i = 0; i < db->enc_count; i++) {
+		update_encoder(db, &db->encs[i]);
+	}
+}
+
+static inline uint8_t encoder_count(const DB_Handle *db) {
+	return db->enc_count;
+}
+#else
+static inline void update_encoders(DB_Handle *db) {
+	(void)db;
+}
+
+static inline uint8_t encoder_count(const DB_Handle *db) {
+	(void)db;
+	return 0;
+}
+#endif
+
+/*
+ * Returns whether button idx with the given prescale is sampled on this scan.
+ * Offsetting by idx spreads buttons with the same prescale over the scans.
+ */
+static inline bool due(uint16_t tick, int idx, uint8_t prescale) {
+	if (prescale > DB_MAX_PRESCALE) {
+		prescale = DB_MAX_PRESCALE;
+	}
+	return ((tick + idx) & ((1u << prescale) - 1)) == 0;
+}
+
+/*
+ * Shift the latest raw sample or debounced state of a button into its
+ * history, if a history is attached.
+ */
+static inline void record(DB_Handle *db, int idx, bool in, uint8_t state) {
+#ifndef DB_CONFIG_NO_HISTORY
+	if (db->history != NULL) {
+		bool bit = db->history_raw ? in : (state & curr_state);
+		db->history[idx] = (db->history[idx] << 1) | bit;
+	}
+#else
+	(void)db;
+	(void)idx;
+	(void)in;
+	(void)state;
+#endif
+}
+
+#ifndef DB_CONFIG_NO_HISTORY
+/*
+ * Number of set bits in the newest n samples of a history.
+ */
+static inline uint8_t history_count(DB_History history, uint8_t n) {
+	if (n < DB_HISTORY_BITS) {
+		history &= ((DB_History)1 << n) - 1;
+	}
+#if defined(__GNUC__) && defined(DB_CONFIG_HISTORY_64)
+	return (uint8_t)__builtin_popcountll(history);
+#elif defined(__GNUC__)
+	return (uint8_t)__builtin_popcountl(history);
+#else
+	uint8_t count = 0;
+	for (; history != 0; history &= history - 1) {
+		count++;
+	}
+	return count;
+#endif
+}
+#endif
+
+/*
+ * Pin levels already read during one DB_Update or DB_Update_Budget call, for
+ * handles with shared pins. Lives on the caller's stack and is reached
+ * through db->pins, so every kernel call of the update shares it.
+ */
+typedef struct DB_Pin_Cache {
+	DB_Word seen[DB_WORDS(256)];
+	DB_Word level[DB_WORDS(256)];
+} pin_cache;
+
+/*
+ * Read a pin through the handle's reader, or take it from a completed bank
+ * read, where the pin ID selects a bit of the bank word. With a pin cache,
+ * each physical pin is only read once per update.
+ */
+static inline bool sample(const DB_Handle *db, const DB_Word *bank, pin_cache *cache, uint8_t pin) {
+	if (bank != NULL) {
+		return (*bank >> (pin % DB_WORD_BITS)) & 1;
+	}
+	if (cache == NULL) {
+		return db->rd(pin);
+	}
+	DB_Word mask = (DB_Word)1 << (pin % DB_WORD_BITS);
+	if ((cache->seen[pin / DB_WORD_BITS] & mask) == 0) {
+		cache->seen[pin / DB_WORD_BITS] |= mask;
+		if (db->rd(pin)) {
+			cache->level[pin / DB_WORD_BITS] |= mask;
+		}
+	}
+	return (cache->level[pin / DB_WORD_BITS] & mask) != 0;
+}
+
+/*
+ * Update the buttons with indices in [first, end). tick counts the scans of
+ * this range and drives the per-button prescalers. bank is the completed
+ * bank read for the range, or NULL to read every pin through db->rd.
+ *
+ * _state stores different flags in its bits
+ * 0b00000abc
+ * a: rising edge latch
+ * b: falling edge latch
+ * c: current state
+ * 0: undefined
+ */
+static void scan(DB_Handle *db, int first, int end, uint16_t tick, const DB_Word *bank) {
+	pin_cache *cache = (bank == NULL) ? db->pins : NULL;
+
+	if (db->layout == DB_LAYOUT_PACKED) {
+		for (int i = first; i < end; i++) {
+			if (!due(tick, i, DB_FLASH_RD(db->cfg[i].prescale))) {
+				continue;
+			}
+			DB_Packed p = db->packed[i];
+			DB_Count counter = p >> PACKED_SHIFT;
+			uint8_t state = p & PACKED_FLAGS;
+
+			// perform debounce update
+			bool in = sample(db, bank, cache, DB_FLASH_RD(db->cfg[i].pin));
+			uint8_t edge = integrate(&counter, DB_FLASH_RD(db->cfg[i].threshold), &state, in);
+			db->packed[i] = (DB_Packed)((counter << PACKED_SHIFT) | state);
+			record(db, i, in, state);
+			if (edge != 0) {
+				emit(db, i, NULL, edge);
+			}
+		}
+	}
+	else if (db->layout == DB_LAYOUT_SPLIT) {
+		for (int i = first; i < end; i++) {
+			if (!due(tick, i, DB_FLASH_RD(db->cfg[i].prescale))) {
+				continue;
+			}
+			DB_State *st = &db->states[i];
+			DB_Count counter = st->_counter;
+
+			// perform debounce update
+			bool in = sample(db, bank, cache, DB_FLASH_RD(db->cfg[i].pin));
+			uint8_t edge = integrate(&counter, DB_FLASH_RD(db->cfg[i].threshold), &st->_state, in);
+			st->_counter = (DB_Count_Store)counter;
+			record(db, i, in, st->_state);
+			if (edge != 0) {
+				emit(db, i, NULL, edge);
+			}
+		}
+	}
+#ifndef DB_CONFIG_NO_POOL
+	else if (db->layout == DB_LAYOUT_POOL) {
+		for (int i = first; i < end; i++) {
+			DB_Button *btn = db->slots[i];
+			if (btn == NULL || !due(tick, i, btn->prescale)) {
+				continue;
+			}
+
+			// perform debounce update
+			bool in = sample(db, bank, cache, btn->pin);
+			uint8_t edge = integrate(&btn->_counter, btn->threshold, &btn->_state, in);
+			record(db, i, in, btn->_state);
+			if (edge != 0) {
+				emit(db, i, btn, edge);
+			}
+		}
+	}
+#endif
+	else {
+		for (int i = first; i < end; i++) {
+			DB_Button *btn = &(db->btns[i]);
+			if (!due(tick, i, btn->prescale)) {
+				continue;
+			}
+
+			// perform debounce update
+			bool in = sample(db, bank, cache, btn->pin);
+			uint8_t edge = integrate(&btn->_counter, btn->threshold, &btn->_state, in);
+			record(db, i, in, btn->_state);
+			if (edge != 0) {
+				emit(db, i, btn, edge);
+			}
+		}
+	}
+}
+
+/*
+ * Update legacy layout buttons in [first, end) of a handle without
+ * prescalers, shared pins or histories. Every caller passes constant bank,
+ * uniform and notify arguments, so each inlined copy drops the branches its
+ * configuration does not need: uniform hoists threshold out of the loop and
+ * notify is false when nothing consumes edges beyond the button flags.
+ */
+static inline void scan_buttons(DB_Handle *db, int first, int end, const DB_Word *bank, bool uniform, bool notify) {
+	DB_Count threshold = db->btns[0].threshold;
+	for (int i = first; i < end; i++) {
+		DB_Button *btn = &(db->btns[i]);
+		bool in = (bank != NULL) ? (*bank >> (btn->pin % DB_WORD_BITS)) & 1 : db->rd(btn->pin);
+		uint8_t edge = integrate(&btn->_counter, uniform ? threshold : btn->threshold, &btn->_state, in);
+		if (notify && edge != 0) {
+			emit(db, i, btn, edge);
+		}
+	}
+}
+
+static void scan_notify(DB_Handle *db, int first, int end, uint16_t tick, const DB_Word *bank) {
+	(void)tick;
+	if (bank != NULL) {
+		scan_buttons(db, first, end, bank, false, true);
+	}
+	else {
+		scan_buttons(db, first, end, NULL, false, true);
+	}
+}
+
+static void scan_notify_uniform(DB_Handle *db, int first, int end, uint16_t tick, const DB_Word *bank) {
+	(void)tick;
+	if (bank != NULL) {
+		scan_buttons(db, first, end, bank, true, true);
+	}
+	else {
+		scan_buttons(db, first, end, NULL, true, true);
+	}
+}
+
+static void scan_poll(DB_Handle *db, int first, int end, uint16_t tick, const DB_Word *bank) {
+	(void)tick;
+	if (bank != NULL) {
+		scan_buttons(db, first, end, bank, false, false);
+	}
+	else {
+		scan_buttons(db, first, end, NULL, false, false);
+	}
+}
+
+static void scan_poll_uniform(DB_Handle *db, int first, int end, uint16_t tick, const DB_Word *bank) {
+	(void)tick;
+	if (bank != NULL) {
+		scan_buttons(db, first, end, bank, true, false);
+	}
+	else {
+		scan_buttons(db, first, end, NULL, true, false);
+	}
+}
+
+/*
+ * Pick the scan routine for the handle's current configuration. Called by
+ * every DB_Init function that changes what a scan has to do.
+ */
+static void select_kernel(DB_Handle *db) {
+	db->kernel = scan;
+	if (db->layout != DB_LAYOUT_BUTTON || db->shared || db->count == 0) {
+		return;
+	}
+#ifndef DB_CONFIG_NO_HISTORY
+	if (db->history != NULL) {
+		return;
+	}
+#endif
+	bool uniform = true;
+	for (int i = 0; i < db->count; i++) {
+		if (db->btns[i].prescale != 0) {
+			return;
+		}
+		uniform = uniform && (db->btns[i].threshold == db->btns[0].threshold);
+	}
+	bool notify = db->state_bits != NULL || db->rise_bits != NULL || db->dirty != NULL;
+#ifndef DB_CONFIG_NO_VIRTUAL
+	notify = notify || db->virts != NULL;
+#endif
+#ifndef DB_CONFIG_NO_CALLBACKS
+	notify = notify || db->cb != NULL || db->handlers != NULL;
+#endif
+	if (notify) {
+		db->kernel = uniform ? scan_notify_uniform : scan_notify;
+	}
+	else {
+		db->kernel = uniform ? scan_poll_uniform : scan_poll;
+	}
+}
+
+#ifndef DB_CONFIG_NO_GROUPS
+/*
+ * Feed a completed bank read into the group's buttons, then start the next
+ * read. A group whose read is still in flight is skipped until it completes.
+ */
+static void update_bank(DB_Handle *db, DB_Group *grp, uint8_t g) {
+	if (grp->_bank == BANK_READY) {
+		DB_Word bits = grp->_sample;
+		db->kernel(db, grp->first, grp->first + grp->count, grp->_scans++, &bits);
+		grp->_bank = BANK_IDLE;
+	}
+	if (grp->_bank == BANK_IDLE) {
+		// mark busy first, the driver may complete from inside start
+		grp->_bank = BANK_BUSY;
+		grp->start(grp->ctx, g);
+	}
+}
+
+/*
+ * Read the port of a group oversample times and return the majority vote.
+ */
+static DB_Word read_port(DB_Group *grp, uint8_t g) {
+	uint8_t count = (grp->oversample > 1) ? grp->oversample : 1;
+	if (count > DB_MAX_OVERSAMPLE) {
+		count = DB_MAX_OVERSAMPLE;
+	}
+	DB_Word samples[DB_MAX_OVERSAMPLE];
+	for (int k = 0; k < count; k++) {
+		samples[k] = grp->port(grp->ctx, g);
+	}
+	return DB_Majority(samples, count);
+}
+
+/*
+ * Scan the groups that are due on this DB_Update call.
+ */
+static void update_groups(DB_Handle *db) {
+	for (int g = 0; g < db->group_count; g++) {
+		DB_Group *grp = &db->groups[g];
+		if (grp->_phase == 0) {
+			if (grp->start == NULL && grp->port != NULL) {
+				DB_Word bits = read_port(grp, g);
+				db->kernel(db, grp->first, grp->first + grp->count, grp->_scans++, &bits);
+			}
+			else if (grp->start == NULL) {
+				db->kernel(db, grp->first, grp->first + grp->count, grp->_scans++, NULL);
+			}
+			else {
+				update_bank(db, grp, g);
+			}
+			grp->_phase = (grp->divider > 1) ? grp->divider - 1 : 0;
+		}
+		else {
+			grp->_phase--;
+		}
+	}
+}
+
+static inline uint8_t group_count(const DB_Handle *db) {
+	return db->group_count;
+}
+#else
+static inline void update_groups(DB_Handle *db) {
+	(void)db;
+}
+
+static inline uint8_t group_count(const DB_Handle *db) {
+	(void)db;
+	return 0;
+}
+#endif
+
+/*
+ * Returns whether two buttons of a freshly initialized handle use the same
+ * pin, in which case each update reads the pin once and fans the
+ * value out.
+ */
+static bool find_shared_pins(const DB_Handle *db) {
+	DB_Word seen[DB_WORDS(256)] = {0};
+	for (int i = 0; i < db->count; i++) {
+		uint8_t pin = (db->cfg != NULL) ? DB_FLASH_RD(db->cfg[i].pin) : db->btns[i].pin;
+		DB_Word mask = (DB_Word)1 << (pin % DB_WORD_BITS);
+		if ((seen[pin / DB_WORD_BITS] & mask) != 0) {
+			return true;
+		}
+		seen[pin / DB_WORD_BITS] |= mask;
+	}
+	return false;
+}
+
+/*
+ * Populate the fields shared by every layout and detach optional features.
+ */
+static void bind(DB_Handle *db, uint8_t count, DB_GPIO_Read rd, DB_Event_Callback cb) {
+	db->btns = NULL;
+	db->count = count;
+	db->rd = rd;
+#ifndef DB_CONFIG_NO_CALLBACKS
+	db->cb = cb;
+	db->handlers = NULL;
+#else
+	(void)cb;
+#endif
+#ifndef DB_CONFIG_NO_ENCODERS
+	db->encs = NULL;
+	db->enc_count = 0;
+#endif
+	db->cfg = NULL;
+	db->packed = NULL;
+	db->states = NULL;
+#ifndef DB_CONFIG_NO_GROUPS
+	db->groups = NULL;
+	db->group_count = 0;
+#endif
+#ifndef DB_CONFIG_NO_POOL
+	db->slots = NULL;
+	db->free_slots = NULL;
+	db->free_count = 0;
+#endif
+	db->state_bits = NULL;
+	db->rise_bits = NULL;
+	db->fall_bits = NULL;
+	db->dirty = NULL;
+	db->dirty_count = 0;
+	db->tick = 0;
+	db->cursor = 0;
+	db->shared = false;
+	db->pins = NULL;
+#ifndef DB_CONFIG_NO_VIRTUAL
+	db->virts = NULL;
+	db->virt_count = 0;
+	db->changed = 0;
+#endif
+#ifndef DB_CONFIG_NO_HISTORY
+	db->history = NULL;
+	db->history_raw = false;
+#endif
+	db->kernel = scan;
+#ifdef DB_CONFIG_PROFILE
+	DB_Profile_Reset(&db->prof_update);
+	DB_Profile_Reset(&db->prof_callback);
+#endif
+}
+
 void DB_Init(DB_Handle *db, DB_Button *buttons, uint8_t count, DB_GPIO_Read rd, DB_Event_Callback cb) {
 	for (int i = 0; i < count; i++) {
 		bool in = rd(buttons[i].pin);
 		buttons[i]._state = in;
 		buttons[i]._counter = in * buttons[i].threshold;
 	}
+	bind(db, count, rd, cb);
 	db->btns = buttons;
-	db->count = count;
-	db->rd = rd;
-	db->cb = cb;
+	db->layout = DB_LAYOUT_BUTTON;
+	db->shared = find_shared_pins(db);
+	select_kernel(db);
 }
 
-void DB_Update(DB_Handle *db) {
-	/*
-	 * _state stores different flags in its bits
-	 * 0b00000abc
-	 * a: rising edge latch
-	 * b: falling edge latch
-	 * c: current state
-	 * 0: undefined
-	 */
+void DB_Init_Packed(DB_Handle *db, const DB_Config *cfg, DB_Packed *state, uint8_t count, DB_GPIO_Read rd, DB_Event_Callback cb) {
+	for (int i = 0; i < count; i++) {
+		bool in = rd(DB_FLASH_RD(cfg[i].pin));
+		state[i] = (DB_Packed)(((in * DB_FLASH_RD(cfg[i].threshold)) << PACKED_SHIFT) | in);
+	}
+	bind(db, count, rd, cb);
+	db->cfg = cfg;
+	db->packed = state;
+	db->layout = DB_LAYOUT_PACKED;
+	db->shared = find_shared_pins(db);
+}
+
+void DB_Init_Split(DB_Handle *db, const DB_Config *cfg, DB_State *state, uint8_t count, DB_GPIO_Read rd, DB_Event_Callback cb) {
+	for (int i = 0; i < count; i++) {
+		bool in = rd(DB_FLASH_RD(cfg[i].pin));
+		state[i]._state = in;
+		state[i]._counter = in * DB_FLASH_RD(cfg[i].threshold);
+	}
+	bind(db, count, rd, cb);
+	db->cfg = cfg;
+	db->states = state;
+	db->layout = DB_LAYOUT_SPLIT;
+	db->shared = find_shared_pins(db);
+}
+
+#ifndef DB_CONFIG_NO_ENCODERS
+void DB_Init_Encoders(DB_Handle *db, DB_Encoder *encoders, uint8_t count) {
+	for (int i = 0; i < count; i++) {
+		DB_Encoder *enc = &encoders[i];
+		bool a = db->rd(enc->pin_a);
+		bool b = db->rd(enc->pin_b);
+		enc->_state_a = a;
+		enc->_state_b = b;
+		enc->_counter_a = a * enc->threshold;
+		enc->_counter_b = b * enc->threshold;
+		enc->_dir = 0;
+		enc->_sub = 0;
+		enc->_steps = 0;
+		enc->_position = 0;
+	}
+	db->encs = encoders;
+	db->enc_count = count;
+}
+#endif
+
+#ifndef DB_CONFIG_NO_POOL
+void DB_Init_Pool(DB_Handle *db, DB_Button **slots, uint8_t *free_slots, uint8_t capacity, DB_GPIO_Read rd, DB_Event_Callback cb) {
+	for (int i = 0; i < capacity; i++) {
+		slots[i] = NULL;
+		free_slots[i] = capacity - 1 - i; // lowest slot is handed out first
+	}
+	bind(db, capacity, rd, cb);
+	db->slots = slots;
+	db->free_slots = free_slots;
+	db->free_count = capacity;
+	db->layout = DB_LAYOUT_POOL;
+}
+
+int DB_Attach(DB_Handle *db, DB_Button *btn) {
+	if (db->free_count == 0) {
+		return -1;
+	}
+	uint8_t slot = db->free_slots[--db->free_count];
+	bool in = db->rd(btn->pin);
+	btn->_state = in;
+	btn->_counter = in * btn->threshold;
+	db->slots[slot] = btn;
+	if (db->state_bits != NULL) {
+		put_bit(db->state_bits, slot, in);
+	}
+#ifndef DB_CONFIG_NO_HISTORY
+	if (db->history != NULL) {
+		db->history[slot] = in ? ~(DB_History)0 : 0;
+	}
+#endif
+#ifndef DB_CONFIG_NO_VIRTUAL
+	db->changed |= (DB_Word)1 << (slot % DB_WORD_BITS);
+#endif
+	return slot;
+}
+
+void DB_Detach(DB_Handle *db, uint8_t slot) {
+	if (db->slots[slot] == NULL) {
+		return;
+	}
+	db->slots[slot] = NULL;
+	db->free_slots[db->free_count++] = slot;
+	if (db->state_bits != NULL) {
+		put_bit(db->state_bits, slot, false);
+	}
+	if (db->rise_bits != NULL) {
+		// unfetched edges belong to the detached button, not the slot's next one
+		DB_Word keep = ~((DB_Word)1 << (slot % DB_WORD_BITS));
+		DB_ATOMIC_AND(&db->rise_bits[slot / DB_WORD_BITS], keep);
+		DB_ATOMIC_AND(&db->fall_bits[slot / DB_WORD_BITS], keep);
+	}
+#ifndef DB_CONFIG_NO_VIRTUAL
+	db->changed |= (DB_Word)1 << (slot % DB_WORD_BITS);
+#endif
+}
+#endif
+
+#ifndef DB_CONFIG_NO_VIRTUAL
+void DB_Init_Virtual(DB_Handle *db, DB_Virtual *virts, uint8_t count) {
+	for (int v = 0; v < count; v++) {
+		DB_Virtual *virt = &virts[v];
+		virt->_deps = 0;
+		for (int k = 0; k < virt->count; k++) {
+			virt->_deps |= (DB_Word)1 << (virt->inputs[k] % DB_WORD_BITS);
+		}
+		virt->btn._state = evaluate_virtual(db, virt);
+		virt->btn._counter = 0;
+	}
+	db->virts = virts;
+	db->virt_count = count;
+	db->changed = 0;
+	select_kernel(db);
+}
+#endif
+
+#ifndef DB_CONFIG_NO_HISTORY
+void DB_Init_History(DB_Handle *db, DB_History *history, bool raw) {
 	for (int i = 0; i < db->count; i++) {
-		DB_Button *btn = &(db->btns[i]);
+		history[i] = state_at(db, i) ? ~(DB_History)0 : 0;
+	}
+	db->history = history;
+	db->history_raw = raw;
+	select_kernel(db);
+}
+#endif
 
-		// perform debounce update
-		if (db->rd(btn->pin)) {
-			if (btn->_counter < btn->threshold) {
-				btn->_counter++;
-			}
-			else {
-				if ((btn->_state & curr_state) == 0) {
-					btn->_state = btn->_state | rising_edge; // set rising edge bit
-					if (db->cb != NULL) {
-						// event callback
-						DB_Event ev = {
-							.btn = btn,
-							.ev_type = DB_RISING_EDGE
-						};
-						db->cb(ev);
-					}
-				}
-				btn->_state = btn->_state | curr_state; // set state bit
-			}
+#ifndef DB_CONFIG_NO_CALLBACKS
+void DB_Init_Handlers(DB_Handle *db, const DB_Handler *handlers) {
+	db->handlers = handlers;
+	select_kernel(db);
+}
+#endif
+
+void DB_Init_Bitmap(DB_Handle *db, DB_Word *state_bits) {
+	for (int i = 0; i < db->count; i++) {
+		put_bit(state_bits, i, state_at(db, i));
+	}
+	db->state_bits = state_bits;
+	select_kernel(db);
+}
+
+void DB_Init_Edge_Bitmaps(DB_Handle *db, DB_Word *rise_bits, DB_Word *fall_bits) {
+	for (int w = 0; w < DB_WORDS(db->count); w++) {
+		rise_bits[w] = 0;
+		fall_bits[w] = 0;
+	}
+	db->rise_bits = rise_bits;
+	db->fall_bits = fall_bits;
+	select_kernel(db);
+}
+
+void DB_Init_Dirty(DB_Handle *db, uint8_t *dirty) {
+	db->dirty = dirty;
+	db->dirty_count = 0;
+	select_kernel(db);
+}
+
+#ifndef DB_CONFIG_NO_GROUPS
+void DB_Init_Groups(DB_Handle *db, DB_Group *groups, uint8_t count) {
+	for (int g = 0; g < count; g++) {
+		groups[g]._phase = 0;
+		groups[g]._scans = 0;
+		groups[g]._bank = BANK_IDLE;
+	}
+	db->groups = groups;
+	db->group_count = count;
+}
+
+void DB_Bank_Complete(DB_Handle *db, uint8_t group, DB_Word bits) {
+	DB_Group *grp = &db->groups[group];
+	grp->_sample = bits;
+	grp->_bank = BANK_READY;
+}
+
+void DB_Bank_Abort(DB_Handle *db, uint8_t group) {
+	db->groups[group]._bank = BANK_IDLE;
+}
+#endif
+
+DB_Word DB_Majority(const DB_Word *samples, uint8_t count) {
+	if (count == 1) {
+		return samples[0];
+	}
+	if (count == 3) {
+		DB_Word a = samples[0], b = samples[1], c = samples[2];
+		return (a & b) | (a & c) | (b & c);
+	}
+
+	// bit-sliced counters: bit n of plane p is bit p of pin n's high count
+	DB_Word planes[4] = {0};
+	for (int k = 0; k < count; k++) {
+		DB_Word carry = samples[k];
+		for (int p = 0; p < 4; p++) {
+			DB_Word next = planes[p] & carry;
+			planes[p] ^= carry;
+			carry = next;
+		}
+	}
+
+	// compare every pin's count against count / 2 + 1, most significant first
+	uint8_t need = count / 2 + 1;
+	DB_Word above = 0;
+	DB_Word equal = ~(DB_Word)0;
+	for (int p = 3; p >= 0; p--) {
+		if ((need >> p) & 1) {
+			equal &= planes[p];
 		}
 		else {
-			if (btn->_counter != 0) {
-				btn->_counter--;
-			}
-			else {
-				if ((btn->_state & curr_state) == 1) {
-					btn->_state = btn->_state | falling_edge; // set falling edge bit
-					if (db->cb != NULL) {
-						// event callback
-						DB_Event ev = {
-							.btn = btn,
-							.ev_type = DB_FALLING_EDGE
-						};
-						db->cb(ev);
-					}
-				}
-				btn->_state = btn->_state & ~curr_state; // clear state bit
-			}
+			above |= equal & planes[p];
+			equal &= ~planes[p];
+		}
+	}
+	return above | equal;
+}
+
+void DB_Update(DB_Handle *db) {
+	PROFILE_START();
+	db->dirty_count = 0;
+	pin_cache shared_pins;
+	if (db->shared) {
+		memset(&shared_pins, 0, sizeof(shared_pins));
+		db->pins = &shared_pins;
+	}
+
+	if (group_count(db) == 0) {
+		db->kernel(db, 0, db->count, db->tick++, NULL);
+	}
+	else {
+		update_groups(db);
+	}
+	db->pins = NULL;
+
+	update_virtuals(db);
+	update_encoders(db);
+
+	PROFILE_END(&db->prof_update);
+}
+
+bool DB_Update_Budget(DB_Handle *db, uint8_t max, DB_Deadline expired) {
+	PROFILE_START();
+	db->dirty_count = 0;
+	pin_cache shared_pins;
+	if (db->shared) {
+		memset(&shared_pins, 0, sizeof(shared_pins));
+		db->pins = &shared_pins;
+	}
+
+	bool wrapped = false;
+	int left = (max != 0) ? max : db->count;
+	while (left > 0 && db->count != 0) {
+		int first = db->cursor;
+		// with a deadline, check it after every button
+		int end = first + ((expired != NULL) ? 1 : left);
+		if (end > db->count) {
+			end = db->count;
+		}
+		db->kernel(db, first, end, db->tick, NULL);
+		left -= end - first;
+		db->cursor = end;
+
+		if (db->cursor == db->count) {
+			db->cursor = 0;
+			db->tick++;
+			wrapped = true;
+			break;
+		}
+		if (expired != NULL && expired()) {
+			break;
 		}
 	}
+	db->pins = NULL;
+
+	update_virtuals(db);
+	update_encoders(db);
+
+	PROFILE_END(&db->prof_update);
+	return wrapped;
 }
 
 bool DB_Rd(const DB_Button *btn) {
 	return btn->_state & curr_state;
 }
 
+#ifndef DB_CONFIG_NO_EDGE_LATCHES
 bool DB_Rising(DB_Button *btn) {
-	if ((btn->_state & rising_edge) != 0) {
-		btn->_state = btn->_state & ~rising_edge; // clear rising edge bit
-		return true;
-	}
-	return false;
+	return take_edges(&btn->_state, rising_edge); // clear rising edge bit
 }
 
 bool DB_Falling(DB_Button *btn) {
-	if ((btn->_state & falling_edge) != 0) {
-		btn->_state = btn->_state & ~falling_edge; // clear falling edge bit
-		return true;
-	}
-	return false;
+	return take_edges(&btn->_state, falling_edge); // clear falling edge bit
 }
 
 bool DB_Changed(DB_Button *btn) {
-	if ((btn->_state & (rising_edge | falling_edge)) != 0) {
-		btn->_state = btn->_state & ~(rising_edge | falling_edge); // clear rising and falling edge bits
-		return true;
+	return take_edges(&btn->_state, rising_edge | falling_edge); // clear rising and falling edge bits
+}
+#endif
+
+bool DB_Rd_Idx(const DB_Handle *db, uint8_t idx) {
+	return *flags_of(db, idx) & curr_state;
+}
+
+#ifndef DB_CONFIG_NO_EDGE_LATCHES
+bool DB_Rising_Idx(DB_Handle *db, uint8_t idx) {
+	return take_edges(flags_of(db, idx), rising_edge);
+}
+
+bool DB_Falling_Idx(DB_Handle *db, uint8_t idx) {
+	return take_edges(flags_of(db, idx), falling_edge);
+}
+
+bool DB_Changed_Idx(DB_Handle *db, uint8_t idx) {
+	return take_edges(flags_of(db, idx), rising_edge | falling_edge);
+}
+#endif
+
+
+#ifndef DB_CONFIG_NO_ENCODERS
+int16_t DB_Enc_Steps(DB_Encoder *enc) {
+	int16_t steps = enc->_steps;
+	enc->_steps = 0;
+	return steps;
+}
+
+int32_t DB_Enc_Position(const DB_Encoder *enc) {
+	return enc->_position;
+}
+#endif
+
+const DB_Word *DB_Rd_Bitmap(const DB_Handle *db) {
+	return db->state_bits;
+}
+
+void DB_Fetch_Edges(DB_Handle *db, DB_Word *rising, DB_Word *falling) {
+	for (int w = 0; w < DB_WORDS(db->count); w++) {
+		if (rising != NULL) {
+			rising[w] = DB_ATOMIC_XCHG(&db->rise_bits[w], 0);
+		}
+		if (falling != NULL) {
+			falling[w] = DB_ATOMIC_XCHG(&db->fall_bits[w], 0);
+		}
+	}
+}
+
+uint8_t DB_Dirty(const DB_Handle *db, const uint8_t **list) {
+	*list = db->dirty;
+	return db->dirty_count;
+}
+
+#ifdef DB_CONFIG_PROFILE
+void DB_Profile_Reset(DB_Profile *prof) {
+	prof->min = 0;
+	prof->max = 0;
+	prof->sum = 0;
+	prof->count = 0;
+	for (int b = 0; b < DB_PROFILE_BINS; b++) {
+		prof->hist[b] = 0;
 	}
-	return false;
 }
 
+uint32_t DB_Profile_Mean(const DB_Profile *prof) {
+	return (prof->count != 0) ? (uint32_t)(prof->sum / prof->count) : 0;
+}
+#endif
+
+/*
+ * FNV-1a hash over the configuration of every button and encoder, used
+ * to reject snapshots taken with a different configuration.
+ */
+static uint32_t config_hash(const DB_Handle *db) {
+	uint32_t hash = 2166136261u;
+	for (int i = 0; i < db->count; i++) {
+		uint32_t pin = 0xFFFF;
+		uint32_t threshold = 0;
+		uint32_t prescale = 0;
+		if (db->cfg != NULL) {
+			pin = DB_FLASH_RD(db->cfg[i].pin);
+			threshold = DB_FLASH_RD(db->cfg[i].threshold);
+			prescale = DB_FLASH_RD(db->cfg[i].prescale);
+		}
+		else {
+			const DB_Button *btn = button_at(db, i);
+			if (btn != NULL) {
+				pin = btn->pin;
+				threshold = btn->threshold;
+				prescale = btn->prescale;
+			}
+		}
+		hash = (hash ^ pin) * 16777619u;
+		hash = (hash ^ threshold) * 16777619u;
+		hash = (hash ^ prescale) * 16777619u;
+	}
+#ifndef DB_CONFIG_NO_ENCODERS
+	for (int i = 0; i < db->enc_count; i++) {
+		const DB_Encoder *enc = &db->encs[i];
+		hash = (hash ^ enc->pin_a) * 16777619u;
+		hash = (hash ^ enc->pin_b) * 16777619u;
+		hash = (hash ^ enc->threshold) * 16777619u;
+	}
+#endif
+	return hash;
+}
+
+static size_t record_size(const DB_Handle *db) {
+	return (db->layout == DB_LAYOUT_PACKED) ? sizeof(DB_Packed) : sizeof(DB_State);
+}
+
+size_t DB_Snapshot_Size(const DB_Handle *db) {
+	return sizeof(snapshot_header) + db->count * record_size(db) + encoder_count(db) * sizeof(enc_record);
+}
+
+size_t DB_Save(const DB_Handle *db, void *buf, size_t len) {
+	size_t size = DB_Snapshot_Size(db);
+	if (len < size) {
+		return 0;
+	}
+	snapshot_header hdr = {
+		.magic = SNAPSHOT_MAGIC,
+		.config_hash = config_hash(db),
+		.layout = db->layout,
+		.count = db->count,
+		.enc_count = encoder_count(db),
+		.record_size = (uint8_t)record_size(db)
+	};
+	uint8_t *out = buf;
+	memcpy(out, &hdr, sizeof(hdr));
+	out += sizeof(hdr);
+
+	switch (db->layout) {
+	case DB_LAYOUT_PACKED:
+		memcpy(out, db->packed, db->count * sizeof(DB_Packed));
+		break;
+	case DB_LAYOUT_SPLIT:
+		memcpy(out, db->states, db->count * sizeof(DB_State));
+		break;
+	default:
+		for (int i = 0; i < db->count; i++) {
+			const DB_Button *btn = button_at(db, i);
+			DB_State rec = {0};
+			if (btn != NULL) {
+				rec._counter = (DB_Count_Store)btn->_counter;
+				rec._state = btn->_state;
+			}
+			memcpy(out + i * sizeof(DB_State), &rec, sizeof(rec));
+		}
+		break;
+	}
+	out += db->count * record_size(db);
+
+#ifndef DB_CONFIG_NO_ENCODERS
+	for (int i = 0; i < db->enc_count; i++) {
+		const DB_Encoder *enc = &db->encs[i];
+		enc_record rec = {
+			.counter_a = (DB_Count_Store)enc->_counter_a,
+			.counter_b = (DB_Count_Store)enc->_counter_b,
+			.state_a = enc->_state_a,
+			.state_b = enc->_state_b,
+			.dir = enc->_dir,
+			.sub = enc->_sub,
+			.steps = enc->_steps,
+			.position = enc->_position
+		};
+		memcpy(out + i * sizeof(rec), &rec, sizeof(rec));
+	}
+#endif
+	return size;
+}
+
+bool DB_Restore(DB_Handle *db, const void *buf, size_t len) {
+	snapshot_header hdr;
+	if (len < sizeof(hdr) || len < DB_Snapshot_Size(db)) {
+		return false;
+	}
+	memcpy(&hdr, buf, sizeof(hdr));
+	if (hdr.magic != SNAPSHOT_MAGIC || hdr.layout != db->layout || hdr.count != db->count
+			|| hdr.enc_count != encoder_count(db) || hdr.record_size != record_size(db)
+			|| hdr.config_hash != config_hash(db)) {
+		return false;
+	}
+	const uint8_t *in = (const uint8_t *)buf + sizeof(hdr);
+
+	switch (db->layout) {
+	case DB_LAYOUT_PACKED:
+		memcpy(db->packed, in, db->count * sizeof(DB_Packed));
+		break;
+	case DB_LAYOUT_SPLIT:
+		memcpy(db->states, in, db->count * sizeof(DB_State));
+		break;
+	default:
+		for (int i = 0; i < db->count; i++) {
+			DB_Button *btn = button_at(db, i);
+			if (btn != NULL) {
+				DB_State rec;
+				memcpy(&rec, in + i * sizeof(DB_State), sizeof(rec));
+				btn->_counter = rec._counter;
+				btn->_state = rec._state;
+			}
+		}
+		break;
+	}
+	in += db->count * record_size(db);
+
+#ifndef DB_CONFIG_NO_ENCODERS
+	for (int i = 0; i < db->enc_count; i++) {
+		DB_Encoder *enc = &db->encs[i];
+		enc_record rec;
+		memcpy(&rec, in + i * sizeof(rec), sizeof(rec));
+		enc->_counter_a = rec.counter_a;
+		enc->_counter_b = rec.counter_b;
+		enc->_state_a = rec.state_a;
+		enc->_state_b = rec.state_b;
+		enc->_dir = rec.dir;
+		enc->_sub = rec.sub;
+		enc->_steps = rec.steps;
+		enc->_position = rec.position;
+	}
+#endif
+
+	if (db->state_bits != NULL) {
+		DB_Init_Bitmap(db, db->state_bits);
+	}
+#ifndef DB_CONFIG_NO_VIRTUAL
+	if (db->virts != NULL) {
+		// re-derive from the restored inputs, without raising events
+		DB_Init_Virtual(db, db->virts, db->virt_count);
+	}
+#endif
+#ifndef DB_CONFIG_NO_HISTORY
+	if (db->history != NULL) {
+		DB_Init_History(db, db->history, db->history_raw);
+	}
+#endif
+	return true;
+}
+
+#ifndef DB_CONFIG_NO_HISTORY
+bool DB_Held_Within(const DB_Handle *db, uint8_t idx, uint8_t n) {
+	return history_count(db->history[idx], n) != 0;
+}
+
+bool DB_Held_For(const DB_Handle *db, uint8_t idx, uint8_t n) {
+	return n != 0 && history_count(db->history[idx], n) == ((n < DB_HISTORY_BITS) ? n : DB_HISTORY_BITS);
+}
+
+uint8_t DB_Duty(const DB_Handle *db, uint8_t idx, uint8_t n) {
+	return history_count(db->history[idx], n);
+}
+#endif
@@ -0,0 +1,205 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <debounce_shm.h>
+
+/*
+ * Byte offsets of the state bitmap and ring, and the total segment size.
+ */
+static size_t state_offset(void) {
+	return (sizeof(DB_Shm_Header) + 7) & ~(size_t)7;
+}
+
+static size_t ring_offset(uint16_t words) {
+	return (state_offset() + words * sizeof(DB_Word) + 7) & ~(size_t)7;
+}
+
+static size_t segment_size(uint16_t words, uint32_t ring_size) {
+	return ring_offset(words) + ring_size * sizeof(DB_Shm_Slot);
+}
+
+int DB_Shm_Create(DB_Shm *shm, const char *name, uint16_t count, uint32_t ring_size) {
+	uint32_t ring = 1;
+	while (ring < ring_size) {
+		ring <<= 1;
+	}
+	uint16_t words = DB_WORDS(count);
+	size_t size = segment_size(words, ring);
+
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		return -1;
+	}
+	if (ftruncate(fd, (off_t)size) != 0) {
+		int err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+	void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		return -1;
+	}
+
+	// a fresh segment is zero filled, so only the header needs writing
+	shm->hdr = base;
+	shm->state = (DB_Word *)((char *)base + state_offset());
+	shm->ring = (DB_Shm_Slot *)((char *)base + ring_offset(words));
+	shm->size = size;
+	shm->hdr->words = words;
+	shm->hdr->count = count;
+	shm->hdr->ring_size = ring;
+	shm->hdr->version = DB_SHM_VERSION;
+	__atomic_store_n(&shm->hdr->magic, DB_SHM_MAGIC, __ATOMIC_RELEASE);
+	return 0;
+}
+
+int DB_Shm_Publish(DB_Shm *shm, const DB_Handle *db) {
+	DB_Shm_Header *hdr = shm->hdr;
+	const DB_Word *bits = DB_Rd_Bitmap(db);
+	if (bits == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	uint32_t tick = hdr->tick;
+
+	const uint8_t *dirty;
+	uint8_t changed = DB_Dirty(db, &dirty);
+	if (changed != 0) {
+		// only the buttons both sides know about, the rest of the segment stays zero
+		uint16_t count = db->count < hdr->count ? db->count : hdr->count;
+		int full = count / DB_WORD_BITS;
+		int rem = count % DB_WORD_BITS;
+		// seqlock: odd while the bitmap is being written
+		uint32_t seq = hdr->seq;
+		__atomic_store_n(&hdr->seq, seq + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		for (int w = 0; w < hdr->words; w++) {
+			DB_Word word = 0;
+			if (w < full) {
+				word = bits[w];
+			} else if (w == full && rem != 0) {
+				word = bits[w] & (((DB_Word)1 << rem) - 1);
+			}
+			__atomic_store_n(&shm->state[w], word, __ATOMIC_RELAXED);
+		}
+		__atomic_store_n(&hdr->seq, seq + 2, __ATOMIC_RELEASE);
+	}
+
+	uint64_t head = hdr->head;
+	for (int i = 0; i < changed; i++) {
+		if (dirty[i] >= hdr->count) {
+			continue;
+		}
+		DB_Shm_Slot *slot = &shm->ring[head & (hdr->ring_size - 1)];
+		__atomic_store_n(&slot->seq, 2 * head + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		__atomic_store_n(&slot->ev.tick, tick, __ATOMIC_RELAXED);
+		__atomic_store_n(&slot->ev.idx, dirty[i], __ATOMIC_RELAXED);
+		__atomic_store_n(&slot->ev.ev_type, DB_Rd_Idx(db, dirty[i]) ? DB_RISING_EDGE : DB_FALLING_EDGE, __ATOMIC_RELAXED);
+		__atomic_store_n(&slot->seq, 2 * head + 2, __ATOMIC_RELEASE);
+		// advance per event so a lapped reader never waits on a whole batch
+		head++;
+		__atomic_store_n(&hdr->head, head, __ATOMIC_RELEASE);
+	}
+	__atomic_store_n(&hdr->tick, tick + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+void DB_Shm_Close(DB_Shm *shm, const char *name, bool unlink) {
+	munmap(shm->hdr, shm->size);
+	shm->hdr = NULL;
+	if (unlink) {
+		shm_unlink(name);
+	}
+}
+
+int DB_Shm_Open(DB_Shm_Reader *rd, const char *name) {
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(DB_Shm_Header)) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		return -1;
+	}
+
+	const DB_Shm_Header *hdr = base;
+	if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != DB_SHM_MAGIC || hdr->version != DB_SHM_VERSION
+			|| hdr->words != DB_WORDS(hdr->count)
+			|| segment_size(hdr->words, hdr->ring_size) > (size_t)st.st_size) {
+		munmap(base, (size_t)st.st_size);
+		errno = EINVAL;
+		return -1;
+	}
+	rd->hdr = hdr;
+	rd->state = (const DB_Word *)((const char *)base + state_offset());
+	rd->ring = (const DB_Shm_Slot *)((const char *)base + ring_offset(hdr->words));
+	rd->size = (size_t)st.st_size;
+	rd->pos = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+	rd->lost = 0;
+	return 0;
+}
+
+uint32_t DB_Shm_Read_State(const DB_Shm_Reader *rd, DB_Word *out) {
+	const DB_Shm_Header *hdr = rd->hdr;
+	uint32_t seq, tick;
+	do {
+		seq = __atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE);
+		tick = __atomic_load_n(&hdr->tick, __ATOMIC_RELAXED);
+		for (int w = 0; w < hdr->words; w++) {
+			out[w] = __atomic_load_n(&rd->state[w], __ATOMIC_RELAXED);
+		}
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) != 0 || seq != __atomic_load_n(&hdr->seq, __ATOMIC_RELAXED));
+	return tick;
+}
+
+bool DB_Shm_Next_Event(DB_Shm_Reader *rd, DB_Shm_Event *ev) {
+	const DB_Shm_Header *hdr = rd->hdr;
+	for (;;) {
+		uint64_t head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+		if (rd->pos >= head) {
+			return false;
+		}
+		if (head - rd->pos > hdr->ring_size) {
+			// lapped by the publisher, skip to the oldest event still in the ring
+			rd->lost += head - hdr->ring_size - rd->pos;
+			rd->pos = head - hdr->ring_size;
+		}
+
+		const DB_Shm_Slot *slot = &rd->ring[rd->pos & (hdr->ring_size - 1)];
+		uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		ev->tick = __atomic_load_n(&slot->ev.tick, __ATOMIC_RELAXED);
+		ev->idx = __atomic_load_n(&slot->ev.idx, __ATOMIC_RELAXED);
+		ev->ev_type = __atomic_load_n(&slot->ev.ev_type, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (seq == 2 * rd->pos + 2 && __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq) {
+			rd->pos++;
+			return true;
+		}
+		// overwritten while reading, retry from the new head
+	}
+}
+
+void DB_Shm_Close_Reader(DB_Shm_Reader *rd) {
+	munmap((void *)rd->hdr, rd->size);
+	rd->hdr = NULL;
+}
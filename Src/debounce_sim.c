@@ -0,0 +1,76 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <debounce_sim.h>
+
+static DB_Sim *selected = NULL;
+
+/*
+ * xorshift32, returns the next 16 bits of randomness.
+ */
+static inline uint16_t next_random(DB_Sim *sim) {
+	uint32_t x = sim->_rng;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	sim->_rng = x;
+	return (uint16_t)(x >> 16);
+}
+
+void DB_Sim_Init(DB_Sim *sim, DB_Sim_Switch *switches, uint16_t count, uint32_t seed) {
+	for (int i = 0; i < count; i++) {
+		switches[i]._level = false;
+		switches[i]._settle = 0;
+		switches[i]._actuations = 0;
+	}
+	sim->sw = switches;
+	sim->count = count;
+	sim->tick = 0;
+	sim->_rng = (seed != 0) ? seed : 0x2545F491;
+}
+
+void DB_Sim_Select(DB_Sim *sim) {
+	selected = sim;
+}
+
+void DB_Sim_Set(DB_Sim *sim, uint16_t pin, bool level) {
+	DB_Sim_Switch *sw = &sim->sw[pin];
+	if (sw->_level == level) {
+		return;
+	}
+	sw->_level = level;
+	sw->_actuations++;
+	uint32_t bounce = sw->bounce + ((sw->_actuations * sw->wear) >> 8);
+	sw->_settle = sim->tick + bounce;
+}
+
+void DB_Sim_Tick(DB_Sim *sim) {
+	sim->tick++;
+}
+
+bool DB_Sim_Level(const DB_Sim *sim, uint16_t pin) {
+	return sim->sw[pin]._level;
+}
+
+bool DB_Sim_Read(uint8_t pin) {
+	DB_Sim *sim = selected;
+	if (sim == NULL || pin >= sim->count) {
+		return false;
+	}
+	DB_Sim_Switch *sw = &sim->sw[pin];
+	if (sw->stuck != DB_SIM_STUCK_NONE) {
+		return sw->stuck == DB_SIM_STUCK_HIGH;
+	}
+
+	bool level = sw->_level;
+	// compare as signed so the settle tick survives wrap-around
+	if ((int32_t)(sim->tick - sw->_settle) < 0) {
+		uint16_t chatter = (sw->chatter != 0) ? sw->chatter : DB_SIM_DEFAULT_CHATTER;
+		if (next_random(sim) < chatter) {
+			level = !level;
+		}
+	}
+	if (sw->emi != 0 && next_random(sim) < sw->emi) {
+		level = !level;
+	}
+	return level;
+}